@@ -0,0 +1,104 @@
+#ifndef BINLOG_H_
+#define BINLOG_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary format of the supermarket log. Every block of the file has the
+ *  same size: a header starts each run (the log is opened in append
+ *  mode, so a file may contain many), the other blocks are records.
+ * Durations are in nanoseconds, kept in 48 bits (about 78 hours).
+ * Numbers are in the byte order of the machine that wrote them
+ *  (on a different one the header isn't recognized).
+ */
+
+#define BINLOG_MAGIC 0x424b4d53 //"SMKB" read as a little endian int
+#define BINLOG_VERSION 1
+
+//Types of the records, with the text record they stand for
+#define BINLOG_CUSTOMER 1  //C:  id, changed queues, products, time in supermarket, time in queue
+#define BINLOG_SERVED 2    //KC: cashier, customer, time to serve
+#define BINLOG_WORKSHIFT 3 //KS: cashier, workshift
+#define BINLOG_CASHIER 4   //K:  cashier, served customers, products, closures
+#define BINLOG_TOTALS 5    //Served Customers and Bought products
+
+struct __binlog_header{
+  uint32_t magic;
+  uint16_t version;
+  uint16_t record_size;
+  uint32_t reserved[4];
+};
+
+struct __binlog_record{
+  uint8_t type;
+  uint8_t reserved;
+  //Only used by BINLOG_CUSTOMER, saturated at UINT16_MAX
+  uint16_t changed_queues;
+  int32_t id;
+  int32_t count;
+  union{
+    //Split in two, so that the record has no padding
+    struct{
+      uint32_t low[2];
+      uint16_t high[2];
+    }nsecs;
+    int32_t counts[2];
+  };
+};
+
+typedef struct __binlog_reader{
+  const char* data;
+  size_t size;
+  size_t position;
+  //Runs found so far in the file
+  int runs;
+}binlog_reader_t;
+
+/*
+ * \brief Fills a header for a new run.
+ */
+void binlog_header_init(struct __binlog_header* header);
+
+/*
+ * \brief Fill a record of each type, see the BINLOG_* types.
+ */
+void binlog_customer(struct __binlog_record* record, int id, int changed_queues, int products,
+          int64_t nsecs_in_supermarket, int64_t nsecs_in_queue);
+void binlog_served(struct __binlog_record* record, int cashier_id, int customer_id, int64_t nsecs);
+void binlog_workshift(struct __binlog_record* record, int cashier_id, int64_t nsecs);
+void binlog_cashier(struct __binlog_record* record, int cashier_id, int served_customers,
+          int products, int closures);
+void binlog_totals(struct __binlog_record* record, int served_customers, int products);
+
+/*
+ * \brief Duration number index (0 or 1) of the record, in nanoseconds.
+ */
+int64_t binlog_nsecs(const struct __binlog_record* record, int index);
+
+/*
+ * \brief Writes in buffer the record as a line of the text format.
+ * \returns the length of the line, as snprintf.
+ */
+int binlog_format(const struct __binlog_record* record, char* buffer, size_t size);
+
+/*
+ * \brief Maps the whole file in memory.
+ * \returns 0 on success, -1 (with errno set) if the file can't be mapped
+ *                or doesn't start with a valid header.
+ */
+int binlog_open(binlog_reader_t* reader, const char* path);
+
+/*
+ * \brief Next record of the file, pointing inside the mapping (nothing
+ *                is copied). The headers between the runs are skipped.
+ * \returns NULL at the end of the file, or at the first invalid header.
+ */
+const struct __binlog_record* binlog_next(binlog_reader_t* reader);
+
+/*
+ * \brief Unmaps the file. The records returned can't be used anymore.
+ */
+void binlog_close(binlog_reader_t* reader);
+
+#endif
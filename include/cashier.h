@@ -2,8 +2,12 @@
 #define CASHIER_H_
 
 #include <pthread.h>
+#include <histogram.h>
+#include <stats.h>
 #include <utils.h>
 
+struct __customer_at_cashier;
+
 typedef struct __cashier{
   int id;
   pthread_t thread;
@@ -11,48 +15,138 @@ typedef struct __cashier{
   int* status;
   pthread_mutex_t* status_mutex;
   pthread_cond_t* status_closed;
-  struct __cashier_director_comm* queue_customers_count;  
+  //Last time (monotonic_msecs()) the cashier showed to be alive,
+  //  read by the cashiers handler to know how old a reading is.
+  long* heartbeat;
+  //monotonic_msecs() at which the service in progress is expected to
+  //  end (fixed + variable time of the customer), so that a cashier
+  //  serving a big basket doesn't look stuck before then.
+  long* service_end;
+  //Sum of the products of the customers in queue, used
+  //  to estimate how long a new customer would wait.
+  long* pending_products;
+  int fixed_service_time;
+  int variable_service_time;
+  //0 if the queue is the shared line, which is not freed by the cashier
+  int owns_queue;
+  //CASHIER_NORMAL or CASHIER_EXPRESS, never changes
+  int cashier_class;
+  //Milliseconds of waiting worth one product in the priority
+  //  queue, 0 if the queue is served in arrival order.
+  int priority_aging;
+  //Customers served and milliseconds spent serving them,
+  //  read by the cashiers handler to estimate the service rate
+  long service_count;
+  long service_msecs;
+  //Arguments of the thread, kept so that the thread can be
+  //  stopped and started again (see cashier_retire())
+  struct __cashier_args* args;
+  //Totals written in the "K" record, kept between threads
+  int served_customers;
+  int elaborated_products;
+  int closures_count;
+  //monotonic_msecs() of when the cashier was last closed, 0 while
+  //  it is open. Only used by the cashiers handler.
+  long closed_since;
 }cashier_t;
 
+//Indexes of the open cashiers, written only by the cashiers handler
+//  and read without locks by the customers. The version is odd while
+//  the handler is writing, so readers know they have to read again.
+struct __open_cashiers{
+  unsigned long version;
+  int count;
+  int* index;
+  //Where each cashier is inside index, used only by the writer
+  int* position;
+  //Signaled when the set stops being empty, so that a reader
+  //  finding no open cashier sleeps instead of reading again
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+};
+
+//Single line consumed by every open cashier, owned by the main
+struct __shared_line{
+  queue_t queue;
+  long pending_products;
+};
+
+//Classes of cashiers: the express desks only serve customers with
+//  a few products, the normal ones serve everybody else.
+#define CASHIER_NORMAL 0
+#define CASHIER_EXPRESS 1
+#define CASHIER_CLASSES 2
+
+//Policies used by the customers to choose a cashier
+#define SELECT_RANDOM 0
+#define SELECT_TWO_CHOICES 1
+#define SELECT_SHORTEST_WORK 2
+
 struct __all_cashiers{
   cashier_t** cashiers_list;
   int count;
+  //One set for each class of cashiers
+  struct __open_cashiers open_cashiers[CASHIER_CLASSES];
+  //The table has room for max_count cashiers, so it never moves:
+  //  the cashiers handler adds new ones at the end, and they are
+  //  read by the others only once they are in an open set.
+  int max_count;
+  //The express desks are the last ones created at startup, from
+  //  express_first to express_end-1. The same if there are none.
+  int express_first;
+  int express_end;
+  //Customers with up to this many products go to the express desks
+  int express_products_limit;
+  //Copied in each cashier_t, see priority_aging
+  int priority_aging;
+  //Customers with some products let in so far, for each class
+  long arrivals[CASHIER_CLASSES];
+  //Time spent in queue by the customers served, for each class
+  histogram_t queue_wait[CASHIER_CLASSES];
+  //Counters of the whole supermarket, with a shard for each cashier
+  stats_t stats;
+  //Latencies in microseconds: the service time of each cashier (room
+  //  for max_count), and the times of every customer who got out
+  latency_histogram_t* service_time;
+  latency_histogram_t queue_time;
+  latency_histogram_t supermarket_time;
+  latency_histogram_t permission_wait;
+  int selection_policy;
+  //NULL if every cashier has its own queue
+  struct __shared_line* shared_line;
+  //Milliseconds an idle cashier waits before stealing customers from
+  //  the other queues, 0 if disabled. Set when every cashier exists.
+  int steal_wait;
 };
 
 struct __cashier_args{
   int id;
+  cashier_t* cashier;
+  struct __all_cashiers* all_cashiers;
   int fixed_service_time;
   int variable_service_time;
   queue_t* queue;
   int* status;
   pthread_mutex_t* status_mutex;
   pthread_cond_t* status_closed;
-  struct __cashier_director_comm* queue_customers_count;
-  int report_to_director_frequency;
+  long* heartbeat;
+  long* service_end;
+  long* pending_products;
   struct __customers_counter* customers_counter;
   struct __xlog* log;
   struct __xlog* supermarket_log;
-  int* served_customers_count;
-  int* bought_products_count;
-};
-
-struct __report_to_director_args{
-  struct __cashier_director_comm* queue_customers_count;
-  int frequency;
-  queue_t* queue;
-};
-
-struct __cashier_director_comm{
-  int count;
-  pthread_mutex_t mutex;
-  pthread_cond_t old_value;
+  //Used to create new cashiers like this one
+  int queue_reserved_nodes;
+  int queue_capacity;
 };
 
 struct __cashier_cleanup_args{
   struct __cashier_args* cashier_args;
-  pthread_t* report_to_director_thread;
 };
 
+//Minimum number of customers a queue must have to be stolen from
+#define STEAL_MIN_QUEUE 2
+
 #define MIN_FIXED_SERVICE_TIME 20
 #define MAX_FIXED_SERVICE_TIME 80
 
@@ -63,11 +157,10 @@ struct __cashier_cleanup_args{
  *                will need (thread and fifo with mutual exclusion)
  * \param id: progressive and unique id assigned to thread.
  * \param initial_open_cashiers: config value, is used to establish wether
-                   to be cashiers will start opened or closed.
+                   to be cashiers will start opened or closed. The first
+                   express desk is always opened.
  * \param variable_service_time: service time for each product the customer bought
  * \param log: log file where main events will be written by customer thread.
- * \param report_to_director_frequency: frequency expressed in millisecond with
- *                which the report_to_director_thread will update the director.
  * \param customers_counter: pointer to a struct containing an int representing
  *                the number of customers inside the supermarket at a certain
  *                time, the mutex to modify the counter and a condition variable
@@ -75,16 +168,54 @@ struct __cashier_cleanup_args{
  * \param supermarket_seed: seed used inside rand_r, it's generated by the main
  *                since this function will be called by the main thread.
  * \param supermarket_log: main log file where the mandatory info will be written
- *                as specific.
- * \param served_customers_count: log variable requested as specifc.
- * \param bought_products_count: log variable requested as specifc.
+ *                as specific. The totals are counted in all_cashiers->stats.
+ * \param queue_kind: implementation of the cashier's queue (QUEUE_LIST,
+ *                QUEUE_MPSC or QUEUE_RING).
+ * \param queue_reserved_nodes: number of nodes pre-allocated in the pool
+ *                of the cashier's queue.
+ * \param queue_capacity: maximum number of customers in a QUEUE_RING.
+ * \param all_cashiers: the other cashiers, to steal customers from. If its
+ *                shared_line is not NULL, the cashier consumes from that line
+ *                instead of creating its own queue.
  */
 cashier_t* cashier_init(int id, int initial_open_cashiers, int variable_service_time, struct __xlog* log,
-  int report_to_director_frequency, struct __customers_counter* customers_counter, unsigned int* supermarket_seed,
-  struct __xlog* supermarket_log, int* served_customers_count, int* bought_products_count);
+  struct __customers_counter* customers_counter, unsigned int* supermarket_seed,
+  struct __xlog* supermarket_log, int queue_kind, int queue_reserved_nodes, int queue_capacity, struct __all_cashiers* all_cashiers);
+
+/*
+ * \brief Creates a new open cashier, with the same settings as model
+ *                but a new random fixed service time.
+ * \returns the new cashier, NULL if its thread couldn't be started.
+ * \param id: index the cashier will have in the table.
+ * \param seed: seed used inside rand_r.
+ */
+cashier_t* cashier_clone(cashier_t* model, int id, unsigned int* seed);
+
+/*
+ * \brief Starts again the thread of a RETIRED cashier, whose status
+ *                must already be OPEN.
+ * \returns 0 if the thread couldn't be started.
+ */
+int cashier_restart(cashier_t* cashier);
+
+/*
+ * \brief Stops the thread of a closed cashier, keeping everything else,
+ *                so that a lot of closed cashiers don't cost a thread each.
+ *                Customers and the other cashiers may still be reading the
+ *                cashier, so it is only freed by cashier_join().
+ */
+void cashier_retire(cashier_t* cashier);
 
 /*
- * \brief Joins the thread inside the cashier passed as param.
+ * \brief Wakes up the cashier if it is waiting for customers. Must be
+ *                called on every cashier before joining any of them, since
+ *                with a shared line any cashier can take the "wake up".
+ */
+void cashier_wake_up(cashier_t* cashier);
+
+/*
+ * \brief Joins the thread inside the cashier passed as param, if it
+ *                has not been retired, and frees the cashier.
  * \param cashier: pointer to cashier to join.
  */
 void cashier_join(cashier_t* cashier);
@@ -96,6 +227,87 @@ void cashier_join(cashier_t* cashier);
  */
 void cashier_cleanup(void* args_pointer);
 
+/*
+ * \brief Tells every customer still in the queue that the cashier has been
+ *                closed, so that they will choose another one. Must be called
+ *                by a thread allowed to pop from the queue.
+ * \param cashier: the closed cashier.
+ */
+void cashier_send_away(cashier_t* cashier);
+
+/*
+ * \brief Pushes a customer in the queue of the cashier, without waiting.
+ * \returns 0 if the queue is full.
+ */
+int cashier_try_enqueue(cashier_t* cashier, struct __customer_at_cashier* customer);
+
+/*
+ * \brief Moves the last customer in the queue of from at the tail of the
+ *                queue of to, as if he changed queue by himself. In a
+ *                priority queue the customer keeps his key. Only for QUEUE_LIST,
+ *                and to must be kept open until the function returns.
+ * \returns the id of the customer moved, -1 if there was nobody to move.
+ */
+int cashier_move_last(cashier_t* from, cashier_t* to);
+
+/*
+ * \brief Class of the cashier with the given index.
+ */
+int cashier_class_of(struct __all_cashiers* all_cashiers, int cashier_index);
+
+/*
+ * \brief Class of the cashiers a customer with products_count
+ *                products has to choose from.
+ */
+int customer_class_of(struct __all_cashiers* all_cashiers, int products_count);
+
+/*
+ * \brief Expected time in milliseconds needed to serve every
+ *                customer currently in the queue of the cashier.
+ */
+long cashier_expected_work(cashier_t* cashier);
+
+/*
+ * \brief Initializes an empty set of open cashiers.
+ */
+void open_cashiers_init(struct __open_cashiers* open_cashiers, int cashiers_count);
+
+void open_cashiers_free(struct __open_cashiers* open_cashiers);
+
+/*
+ * \brief Adds or removes a cashier from the set. Must be called
+ *                only by the cashiers handler.
+ */
+void open_cashiers_add(struct __open_cashiers* open_cashiers, int cashier_index);
+void open_cashiers_remove(struct __open_cashiers* open_cashiers, int cashier_index);
+
+/*
+ * \brief Chooses a random cashier among the open ones without locking.
+ *                The cashier may be closed right after, so the caller must
+ *                check its status.
+ * \param seed: seed used inside rand_r.
+ */
+int open_cashiers_pick(struct __open_cashiers* open_cashiers, unsigned int* seed);
+
+/*
+ * \brief Reads the whole set without locking: the reader must start again
+ *                if open_cashiers_read_retry() returns 1.
+ */
+unsigned long open_cashiers_read_begin(struct __open_cashiers* open_cashiers);
+int open_cashiers_read_retry(struct __open_cashiers* open_cashiers, unsigned long version);
+
+/*
+ * \brief Waits until the set has at least one cashier. Called by a
+ *                reader that found it empty.
+ */
+void open_cashiers_wait(struct __open_cashiers* open_cashiers);
+
+/*
+ * \brief Writes in log the percentiles of the latencies recorded so
+ *                far in all_cashiers, as a table under title.
+ */
+void latency_report(struct __all_cashiers* all_cashiers, struct __xlog* log, const char* title);
+
 /*
  * \brief main cashier function. Can be stopped and restarted
  *                by the director.
@@ -103,11 +315,4 @@ void cashier_cleanup(void* args_pointer);
  */
 void* cashier(void* args_pointer);
 
-/*
- * \brief auxiliar cashier function. Informs the director of the 
- *                number of customers in queue at regular time steps.
- * \param args_pointer: args initialized by main.
- */
-void* report_to_director(void* args_pointer);
-
 #endif
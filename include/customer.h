@@ -6,6 +6,9 @@
 #include <time.h>
 #include <utils.h>
 
+struct __customer_engine;
+struct __customer_pool;
+
 typedef struct __customer{
   int id;
   pthread_t thread;
@@ -28,20 +31,38 @@ struct __customer_args{
   struct __xlog* supermarket_log;
 };
 
+//The following two structs are allocated on the stack of the
+//  customer thread, which waits until they have been popped and
+//  answered. They embed the node used to queue them, so that
+//  enqueueing to a cashier or to the director doesn't allocate.
 struct __permission_request{
+  struct __node node;
   int* status;
   pthread_mutex_t* mutex;
   pthread_cond_t* no_permission;
   struct timespec* time_permission_received;
+  //If not NULL, called by the director instead of signaling
+  //  no_permission (used by customers run by the engine).
+  void (*on_permission)(struct __permission_request* request);
 };
 
 struct __customer_at_cashier{
+  struct __node node;
   int id;
   int products_count;
+  //Also increased by the cashiers handler when it moves
+  //  the customer to another queue without waking him.
+  int changed_queues_count;
   int* response;
   pthread_mutex_t* response_mutex;
   pthread_cond_t* no_response;
+  //Time the customer entered the first queue, written by the customer,
+  //  and time he was popped from the last one, written by the cashier
+  struct timespec* time_queue_in;
   struct timespec* time_queue_out;
+  //If not NULL, called by customer_respond() instead of signaling
+  //  no_response (used by customers run by the engine).
+  void (*on_response)(struct __customer_at_cashier* customer);
 };
 
 #define MIN_FIXED_TIME_TO_SHOP 10
@@ -69,11 +90,16 @@ struct __customer_at_cashier{
  *                since this function will be called by the main thread.
  * \param supermarket_log: main log file where the mandatory info will be written
  *                as specific.
+ * \param engine: if not NULL, the customer is run by the engine instead
+ *                of by a new thread (and the returned thread is 0).
+ * \param pool: if not NULL (and engine is NULL), the customer is run by a
+ *                thread of the pool instead of by a new thread.
  */
 customer_t* customer_init(int id, struct __all_cashiers* all_cashiers,
            struct __customers_counter* customers_counter, queue_t* director_permissions_list,
            struct __xlog* log, int max_fixed_time_to_shop, int max_fixed_products_count,
-           unsigned int* supermarket_seed, struct __xlog* supermarket_log);
+           unsigned int* supermarket_seed, struct __xlog* supermarket_log,
+           struct __customer_engine* engine, struct __customer_pool* pool);
 
 /*
  * \brief Cleans the customer thread arguments and signals
@@ -82,6 +108,51 @@ customer_t* customer_init(int id, struct __all_cashiers* all_cashiers,
  */
 void customer_cleanup(void* args_pointer);
 
+/*
+ * \brief Decreases the number of customers inside the supermarket
+ *                and signals the entrance.
+ * \param customers_counter: counter initialized by the main.
+ */
+void customer_leave(struct __customers_counter* customers_counter);
+
+/*
+ * \brief Chooses an open cashier as set by the selection policy.
+ * \returns the cashier, with its status mutex still locked so that it
+ *                can't be closed before the customer is in its queue.
+ * \param all_cashiers: all the cashiers of the supermarket.
+ * \param products_count: products of the customer, choosing between
+ *                the express and the normal cashiers.
+ * \param seed: seed used inside rand_r.
+ * \param index: where the index of the cashier will be written.
+ */
+struct __cashier* customer_choose_cashier(struct __all_cashiers* all_cashiers, int products_count,
+            unsigned int* seed, int* index);
+
+/*
+ * \brief Writes the "C" record requested by specific in the supermarket log
+ *                (as a BINLOG_CUSTOMER record if the log is binary).
+ */
+void customer_write_record(struct __xlog* supermarket_log, int id, struct timespec* time_in_supermarket,
+           struct timespec* time_in_queue, int changed_queues_count, int products_count);
+
+/*
+ * \brief Records the times of a customer in the latency histograms.
+ * \param time_in_queue: time waited at the cashier that served the
+ *                customer, NULL if he wasn't served.
+ * \param permission_wait: time waited for the director's permission,
+ *                NULL if he didn't get it (or didn't need it).
+ */
+void customer_record_latency(struct __all_cashiers* all_cashiers, struct timespec* time_in_supermarket,
+           struct timespec* time_in_queue, struct timespec* permission_wait);
+
+/*
+ * \brief Writes the response for a customer waiting at a cashier and
+ *                wakes him up.
+ * \param customer: struct pushed by the customer in the cashier queue.
+ * \param response: 1 if served, 0 if he must change queue, -2 on sigquit.
+ */
+void customer_respond(struct __customer_at_cashier* customer, int response);
+
 /*
  * \brief main customer function. Will shop for T seconds and
  *                then go pay to a cashier.
@@ -89,4 +160,11 @@ void customer_cleanup(void* args_pointer);
  */
 void* customer(void* args_pointer);
 
+/*
+ * \brief Same as customer(), but runs on the calling thread (used by
+ *                the pool) instead of on a detached thread of its own.
+ *                Frees args.
+ */
+void customer_run(void* args_pointer);
+
 #endif
@@ -0,0 +1,73 @@
+#ifndef CUSTOMER_ENGINE_H_
+#define CUSTOMER_ENGINE_H_
+
+#include <pthread.h>
+#include <time.h>
+#include <customer.h>
+#include <timer_wheel.h>
+#include <utils.h>
+
+//States of a customer run by the engine
+#define ENGINE_SHOPPING 0
+#define ENGINE_CHECKOUT 1
+#define ENGINE_AT_CASHIER 2
+#define ENGINE_AT_DIRECTOR 3
+
+/*
+ * Instead of having a thread for each customer, the engine runs the
+ *  customers as small state machines on a fixed pool of worker threads.
+ * A customer is only run when it has something to do: when its shopping
+ *  time is over (timers), or when a cashier or the director answered it
+ *  (ready queue). While waiting, it's only a struct in a queue.
+ */
+typedef struct __customer_engine{
+  //Customers ready to be run, popped by the workers.
+  queue_t ready;
+  pthread_t* workers;
+  int workers_count;
+  //Wakes up the customers when their shopping time is over.
+  timer_wheel_t* wheel;
+}customer_engine_t;
+
+struct __engine_customer{
+  //Used to push the customer in the ready queue
+  struct __node run_node;
+  struct __customer_args* args;
+  customer_engine_t* engine;
+  int state;
+  unsigned int seed;
+  struct __timer timer;
+  struct timespec time_entered;
+  struct timespec time_queue_in;
+  struct timespec time_queue_out;
+  //Same meaning as the response of a customer thread
+  int response;
+  int permission_status;
+  int full_queues_count;
+  struct __customer_at_cashier at_cashier;
+  struct __permission_request permission;
+};
+
+/*
+ * \brief Dynamic initialization of the engine and of its threads.
+ * \param workers_count: number of threads running the customers.
+ * \param reserved_nodes: number of nodes pre-allocated in the ready queue.
+ * \param wheel: timer wheel used to wait, shared with the rest of the supermarket.
+ */
+customer_engine_t* customer_engine_init(int workers_count, int reserved_nodes, timer_wheel_t* wheel);
+
+/*
+ * \brief Lets a new customer in the supermarket, which will start shopping.
+ *                The engine takes ownership of args.
+ * \param engine: engine initialized by customer_engine_init.
+ * \param args: args initialized by customer_init.
+ */
+void customer_engine_add(customer_engine_t* engine, struct __customer_args* args);
+
+/*
+ * \brief Stops and joins the engine threads and frees the engine.
+ *                Must be called once every customer is out.
+ */
+void customer_engine_join(customer_engine_t* engine);
+
+#endif
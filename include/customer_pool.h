@@ -0,0 +1,52 @@
+#ifndef CUSTOMER_POOL_H_
+#define CUSTOMER_POOL_H_
+
+#include <pthread.h>
+#include <customer.h>
+#include <utils.h>
+
+/*
+ * Instead of creating a thread for each customer, the customers are
+ *  given to a pool of threads which run them one after the other.
+ * A customer still needs a thread for as long as he is inside the
+ *  supermarket, so when every worker is busy a new one is created:
+ *  the pool grows up to the peak number of customers and then
+ *  only reuses its threads.
+ */
+typedef struct __customer_pool{
+  //Customers waiting for a worker, popped by the workers.
+  queue_t jobs;
+  pthread_mutex_t mutex;
+  //Workers waiting for a customer which haven't been promised one yet.
+  int idle;
+  pthread_t* workers;
+  int workers_count;
+  int workers_capacity;
+  //Statistics written in the log at the end
+  int prespawned_count;
+  long submitted;
+}customer_pool_t;
+
+/*
+ * \brief Dynamic initialization of the pool and of its first threads.
+ * \param workers_count: number of threads created right away.
+ * \param reserved_nodes: number of nodes pre-allocated in the jobs queue.
+ */
+customer_pool_t* customer_pool_init(int workers_count, int reserved_nodes);
+
+/*
+ * \brief Lets a new customer in the supermarket, which will be run by
+ *                an idle worker or by a new one. The pool takes ownership of args.
+ * \param pool: pool initialized by customer_pool_init.
+ * \param args: args initialized by customer_init.
+ */
+void customer_pool_submit(customer_pool_t* pool, struct __customer_args* args);
+
+/*
+ * \brief Stops and joins the pool threads, writes the statistics
+ *                in the log and frees the pool.
+ *                Must be called once every customer is out.
+ */
+void customer_pool_join(customer_pool_t* pool, struct __xlog* log);
+
+#endif
@@ -5,6 +5,37 @@
 #include <utils.h>
 #include <customer.h>
 
+//A reading is stale if the cashier has customers in queue but
+//  hasn't shown to be alive for this many handler periods, counted
+//  from the expected end of the service it is doing, if any
+#define STALE_READING_PERIODS 16
+
+//Policies used by the cashiers handler to open and close the desks
+#define SCHEDULER_THRESHOLDS 0
+#define SCHEDULER_PREDICTIVE 1
+#define SCHEDULER_SLO 2
+
+//Weight of the last round in the moving averages of the predictive
+//  scheduler, and rounds in a row it must find too many desks open
+//  before closing some, so that it doesn't flap.
+#define PREDICTIVE_EWMA_WEIGHT 0.2
+#define PREDICTIVE_CLOSE_ROUNDS 10
+
+//The SLO scheduler looks at the queue waits of the last SLO_WINDOW_ROUNDS
+//  rounds, and only if at least SLO_MIN_SAMPLES customers were served.
+//It closes a desk when the percentile has been under SLO_HEADROOM_PERCENT
+//  of the SLO for SLO_CLOSE_ROUNDS rounds, and after any change waits
+//  SLO_COOLDOWN_ROUNDS rounds for the window to show its effects.
+#define SLO_WINDOW_ROUNDS 50
+#define SLO_MIN_SAMPLES 10
+#define SLO_HEADROOM_PERCENT 50
+#define SLO_CLOSE_ROUNDS 10
+#define SLO_COOLDOWN_ROUNDS 10
+
+//With an elastic pool, the thread of a cashier closed for this
+//  many milliseconds is stopped until the cashier is opened again
+#define ELASTIC_RETIRE_MSECS 2000
+
 typedef struct __director{
   pthread_t thread;
 }director_t;
@@ -15,7 +46,7 @@ struct __director_args{
   queue_t* director_permissions_list;
   pthread_t* entrance_thread;
   struct __cashiers_handler_args* cashiers_handler_args;
-  FILE* log;
+  struct __xlog* log;
 };
 
 struct __cashiers_handler_args{
@@ -23,7 +54,24 @@ struct __cashiers_handler_args{
   int director_too_many_customers;
   int director_below_min_limit;
   int director_above_max_limit;
-  int initial_open_cashiers;
+  //Milliseconds of expected wait a customer must save to be moved
+  //  to a shorter queue, 0 if customers never jockey
+  int jockey_margin;
+  //SCHEDULER_THRESHOLDS uses the W/X/Y/Z thresholds, SCHEDULER_PREDICTIVE
+  //  the rates and target_wait, SCHEDULER_SLO the measured waits
+  int scheduler;
+  //Expected wait in milliseconds the predictive scheduler aims at,
+  //  or the SLO on the slo_percentile of the measured waits
+  int target_wait;
+  int slo_percentile;
+  //If set, desks are added beyond K (up to all_cashiers->max_count)
+  //  and the threads of the ones closed for long are retired
+  int elastic_cashiers;
+  //Period in milliseconds with which the latency percentiles are
+  //  written in the log while the supermarket is open, 0 if never
+  int latency_snapshot;
+  //Period in milliseconds with which the queues are sampled
+  int report_to_director_frequency;
 };
 
 /*
@@ -40,14 +88,14 @@ struct __cashiers_handler_args{
  *                to wait for when supermarket is full.
  * \param entrance_thread: pthread_t of the entrance, that will be joined
  *                inside the director thread.
- * \param log: log file where main events will be written by director thread
- *                (not actually used, but could be useful).
+ * \param log: log where main events will be written by the director
+ *                and cashiers handler threads.
  * \param cashiers_handler_args: struct containing informations and variables
  *                that will be used by the cashiers_handler thread.
  */
  director_t* director_init(struct __all_cashiers* all_cashiers, queue_t* director_permissions_list,
                  struct __customers_counter* customers_counter, pthread_t* entrance_thread,
-                 FILE* log, struct __cashiers_handler_args* cashiers_handler_args);
+                 struct __xlog* log, struct __cashiers_handler_args* cashiers_handler_args);
 
 /*
  * \brief Joins the thread inside the director passed as param.
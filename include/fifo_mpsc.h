@@ -0,0 +1,105 @@
+#ifndef FIFO_MPSC_H_
+#define FIFO_MPSC_H_
+
+#include <pthread.h>
+#include <fifo_unbounded.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+/*
+ * Lock-free multi-producer/single-consumer queue (Vyukov's algorithm).
+ * Any thread can push, but only one thread at a time can pop.
+ * The consumer only takes the mutex when the queue is empty and it has
+ *   to be parked, and producers only take it to wake a parked consumer.
+ * Nodes are the same used by fifo_unbounded_t, and are recycled through
+ *   a lock-free stack filled by the consumer.
+ */
+typedef struct __mpsc{
+  //Written by producers
+  struct __node* head;
+  char head_padding[CACHE_LINE_SIZE - sizeof(struct __node*)];
+  //Written by the consumer only
+  struct __node* tail;
+  char tail_padding[CACHE_LINE_SIZE - sizeof(struct __node*)];
+  struct __node stub;
+  int count;
+  int sleeping;
+  pthread_mutex_t mutex;
+  pthread_cond_t empty;
+  struct __node* free_list;
+  struct __fifo_stats stats;
+} fifo_mpsc_t;
+
+/*
+ * \brief Dynamic initialization of fifo_mpsc_t
+ * \param fifo : pointer to the mpsc queue
+ */
+int fifo_mpsc_init(fifo_mpsc_t* fifo);
+
+/*
+ * \brief Pre-allocates nodes inside the pool of the queue.
+ * \param fifo : pointer to the mpsc queue
+ * \param nodes : number of nodes to add to the pool
+ */
+int fifo_mpsc_reserve(fifo_mpsc_t* fifo, int nodes);
+
+/*
+ * \brief Insert a new element at the tail of the queue.
+ *                Can be called by any thread.
+ * \param fifo : pointer to the mpsc queue
+ * \param elem : new element to be inserted
+ */
+void push_mpsc(fifo_mpsc_t* fifo, void* elem);
+
+/*
+ * \brief Insert at the tail of the queue an element with an embedded
+ *                node, initialized with fifo_node_init(). No allocation
+ *                is done. Can be called by any thread.
+ * \param fifo : pointer to the mpsc queue
+ * \param node : node embedded inside the element
+ */
+void push_node_mpsc(fifo_mpsc_t* fifo, struct __node* node);
+
+/*
+ * \brief Remove and return the element at the head of the queue,
+ *                waiting if the queue is empty. Only one thread
+ *                at a time can call it.
+ * \param fifo : pointer to the mpsc queue
+ */
+void* pop_mpsc(fifo_mpsc_t* fifo);
+
+/*
+ * \brief Same as pop_mpsc(), but never waits.
+ * \returns 1 if an element has been removed and written in elem,
+ *                0 if the queue was empty or a producer was still in
+ *                the middle of its push.
+ * \param fifo : pointer to the mpsc queue
+ * \param elem : where the removed element will be written
+ */
+int try_pop_mpsc(fifo_mpsc_t* fifo, void** elem);
+
+/*
+ * \brief returns the number of elements inside the queue. The value
+ *                may already be old when the function returns.
+ * \param fifo : pointer to the mpsc queue
+ */
+int get_count_mpsc(fifo_mpsc_t* fifo);
+
+/*
+ * \brief copies the allocation statistics of the node pool
+ * \param fifo : pointer to the mpsc queue
+ * \param stats : where the statistics will be copied
+ */
+void get_stats_mpsc(fifo_mpsc_t* fifo, struct __fifo_stats* stats);
+
+/*
+ * \brief Remove, if present, remaining elements and the nodes left in
+ *                the pool. Elements pushed with an embedded node are not
+ *                freed. No other thread must be using the queue.
+ * \param fifo : pointer to the mpsc queue
+ */
+void free_mpsc(fifo_mpsc_t* fifo);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef FIFO_RING_H_
+#define FIFO_RING_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+struct __ring_cell{
+  size_t sequence;
+  void* elem;
+};
+
+/*
+ * Bounded multi-producer/multi-consumer ring buffer (Vyukov's algorithm).
+ * The capacity is rounded up to a power of two. Producers and consumers
+ *   work on separate cache lines and never lock while the ring is neither
+ *   full nor empty; otherwise the blocking functions park the thread on
+ *   the corresponding condition variable.
+ */
+typedef struct __ring{
+  //Written by producers
+  size_t enqueue_pos;
+  char enqueue_padding[CACHE_LINE_SIZE - sizeof(size_t)];
+  //Written by consumers
+  size_t dequeue_pos;
+  char dequeue_padding[CACHE_LINE_SIZE - sizeof(size_t)];
+  struct __ring_cell* cells;
+  size_t mask;
+  int push_waiting;
+  int pop_waiting;
+  long full_pushes;
+  pthread_mutex_t mutex;
+  pthread_cond_t not_full;
+  pthread_cond_t not_empty;
+} fifo_ring_t;
+
+/*
+ * \brief Dynamic initialization of fifo_ring_t
+ * \param ring : pointer to the ring buffer
+ * \param capacity : maximum number of elements, rounded up to
+ *                the next power of two.
+ */
+int fifo_ring_init(fifo_ring_t* ring, int capacity);
+
+/*
+ * \brief Insert a new element at the tail of the ring, if there is space.
+ * \returns 1 if the element has been inserted, 0 if the ring is full.
+ * \param ring : pointer to the ring buffer
+ * \param elem : new element to be inserted
+ */
+int try_push_ring(fifo_ring_t* ring, void* elem);
+
+/*
+ * \brief Insert a new element at the tail of the ring, waiting
+ *                while the ring is full.
+ * \param ring : pointer to the ring buffer
+ * \param elem : new element to be inserted
+ */
+void push_ring(fifo_ring_t* ring, void* elem);
+
+/*
+ * \brief Remove the element at the head of the ring, if any.
+ * \returns 1 if an element has been removed and written in elem,
+ *                0 if the ring was empty.
+ * \param ring : pointer to the ring buffer
+ * \param elem : where the removed element will be written
+ */
+int try_pop_ring(fifo_ring_t* ring, void** elem);
+
+/*
+ * \brief Remove and return the element at the head of the ring,
+ *                waiting while the ring is empty.
+ * \param ring : pointer to the ring buffer
+ */
+void* pop_ring(fifo_ring_t* ring);
+
+/*
+ * \brief returns the number of elements inside the ring. The value
+ *                may already be old when the function returns.
+ * \param ring : pointer to the ring buffer
+ */
+int get_count_ring(fifo_ring_t* ring);
+
+/*
+ * \brief returns the capacity of the ring.
+ * \param ring : pointer to the ring buffer
+ */
+int get_capacity_ring(fifo_ring_t* ring);
+
+/*
+ * \brief Remove, if present, remaining elements. No other
+ *                thread must be using the ring.
+ * \param ring : pointer to the ring buffer
+ */
+void free_ring(fifo_ring_t* ring);
+
+#endif
@@ -3,20 +3,54 @@
 
 #include <pthread.h>
 
+struct __fifo_stats{
+  long allocated_nodes;
+  long reused_nodes;
+  int free_nodes;
+  long full_pushes;
+};
+
 typedef struct __linked_list{
   struct __node* head;
   struct __node* tail;
   int count;
+  //Nodes released by pop_fifo() are kept here and reused by
+  //  the next push_fifo(), so that once the pool has grown to
+  //  the peak size of the queue no more malloc/free are done.
+  struct __node* free_list;
+  struct __fifo_stats stats;
 } fifo_unbounded_t;
 
 struct __node{
     void* elem;
     struct __node* next;
+    //Only kept up to date by fifo_unbounded_t, to steal from the tail
+    struct __node* prev;
+    //Priority of the element when pushed with push_node_sorted_fifo(),
+    //  lower keys are popped first. 0 for the other pushes.
+    long key;
+    //1 if the node is embedded inside the element (intrusive
+    //  mode) and so it is not owned by the fifo and its pool.
+    int intrusive;
 };
 
 
+//Chain of nodes detached from a fifo by drain_fifo() or
+//  pop_many_fifo(), that can be walked without holding any lock.
+typedef struct __fifo_chain{
+  struct __node* head;
+  struct __node* tail;
+  int count;
+  //Nodes of the pool already walked by pop_chain(), that
+  //  release_chain_fifo() will give back in one step.
+  struct __node* spare_head;
+  struct __node* spare_tail;
+  int spare_count;
+} fifo_chain_t;
+
+
 //Macro to statically initialize fifo_unbounded_t
-#define FIFO_INITIALIZER {NULL, NULL, 0}
+#define FIFO_INITIALIZER {NULL, NULL, 0, NULL, {0, 0, 0, 0}}
 
 /*
  * \brief Dynamic initialization of fifo_unbounded_t
@@ -24,6 +58,15 @@ struct __node{
  */
 int fifo_init(fifo_unbounded_t* fifo);
 
+/*
+ * \brief Pre-allocates nodes inside the pool of the fifo, so
+ *                that the first pushes won't need to call malloc.
+ * \param fifo : pointer to double_ended linked list
+ * \param nodes : number of nodes to add to the pool
+ * \param mutex: mutual exclusion for sharing fifo between threads
+ */
+int fifo_reserve(fifo_unbounded_t* fifo, int nodes, pthread_mutex_t* mutex);
+
 /*
  * \brief Insert a new element at the tail of the linked list
  * \param fifo : pointer to indexes of double_ended linked list
@@ -34,6 +77,38 @@ int fifo_init(fifo_unbounded_t* fifo);
  */
 void push_fifo(fifo_unbounded_t* fifo, void* elem, pthread_mutex_t* mutex, pthread_cond_t* empty);
 
+/*
+ * \brief Prepares a node embedded inside an element to be pushed with
+ *                push_node_fifo(). The node must stay valid until the
+ *                element is popped.
+ * \param node : node embedded inside the element
+ * \param elem : the element itself, that pop_fifo() will return
+ */
+void fifo_node_init(struct __node* node, void* elem);
+
+/*
+ * \brief Insert at the tail of the linked list an element with an
+ *                embedded node (intrusive mode): no allocation is done
+ *                and the node will not be given to the pool once popped.
+ * \param fifo : pointer to indexes of double_ended linked list
+ * \param node : node initialized with fifo_node_init()
+ * \param mutex: mutual exclusion for sharing fifo between threads
+ * \param empty: condition variable to allow pop_fifo() to wait for
+ *                push when fifo is empty
+ */
+void push_node_fifo(fifo_unbounded_t* fifo, struct __node* node, pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Same as push_node_fifo(), but the element is inserted after every
+ *                element with a key lower or equal than its own, so that the
+ *                fifo becomes a priority queue. The list is walked from the
+ *                tail, since new elements usually have the highest keys.
+ *                NULL ("wake up") elements are skipped by the comparison.
+ * \param key : priority of the element, lower keys are popped first
+ */
+void push_node_sorted_fifo(fifo_unbounded_t* fifo, struct __node* node, long key,
+            pthread_mutex_t* mutex, pthread_cond_t* empty);
+
 /*
  * \brief Remove and return the element at the head of the linked list
  * \param fifo : pointer to indexes of double_ended linked list
@@ -44,7 +119,114 @@ void push_fifo(fifo_unbounded_t* fifo, void* elem, pthread_mutex_t* mutex, pthre
 void* pop_fifo(fifo_unbounded_t* fifo, pthread_mutex_t* mutex, pthread_cond_t* empty);
 
 /*
- * \brief Remove, if present, remaining elements
+ * \brief Same as pop_fifo(), but while the fifo is empty it only waits
+ *                as long as *flag is not 0. Used when many threads pop from
+ *                the same fifo and one of them must be stopped.
+ * \returns NULL if the fifo is empty and the flag is 0.
+ * \param flag : written by other threads, then wake_all_fifo() must be called
+ */
+void* pop_fifo_while(fifo_unbounded_t* fifo, int* flag, pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Same as pop_fifo(), but waits at most msecs milliseconds.
+ * \returns 0 if the fifo is still empty, 1 if elem has been written.
+ */
+int pop_fifo_timed(fifo_unbounded_t* fifo, void** elem, int msecs, pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Removes the element at the tail of the linked list in O(1),
+ *                used by a thread to take work queued for another one.
+ *                A NULL element is never stolen.
+ * \returns 0 if there was nothing to steal.
+ */
+int steal_tail_fifo(fifo_unbounded_t* fifo, void** elem, pthread_mutex_t* mutex);
+
+/*
+ * \brief Same as steal_tail_fifo(), but removes the element at the head,
+ *                the one that would be popped next.
+ */
+int steal_head_fifo(fifo_unbounded_t* fifo, void** elem, pthread_mutex_t* mutex);
+
+/*
+ * \brief Wakes up every thread waiting inside pop_fifo_while(), so that
+ *                they check their flag again.
+ */
+void wake_all_fifo(pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Initialization of an empty fifo_chain_t
+ * \param chain : chain to initialize
+ */
+void fifo_chain_init(fifo_chain_t* chain);
+
+/*
+ * \brief Appends a node, already removed from any fifo or chain,
+ *                at the tail of a chain. No lock is needed.
+ * \param chain : chain owned by the calling thread
+ * \param node : node to append
+ */
+void push_chain(fifo_chain_t* chain, struct __node* node);
+
+/*
+ * \brief Appends a whole chain at the tail of the linked list in O(1).
+ *                The chain is left empty, while its walked nodes are kept
+ *                for release_chain_fifo().
+ * \param fifo : pointer to indexes of double_ended linked list
+ * \param chain : chain to append
+ * \param mutex: mutual exclusion for sharing fifo between threads
+ * \param empty: condition variable to allow pop_fifo() to wait for
+ *                push when fifo is empty
+ */
+void splice_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Same as splice_fifo(), but for a fifo used as a priority queue:
+ *                the chain, sorted by key, is merged with the linked list
+ *                in a single pass, instead of being appended at the tail.
+ */
+void merge_chain_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Detach every element of the linked list in O(1). The elements
+ *                are then read with pop_chain() without holding the lock.
+ * \returns the number of elements detached.
+ * \param fifo : pointer to indexes of double_ended linked list
+ * \param chain : where the detached elements will be put
+ * \param mutex: mutual exclusion for sharing fifo between threads
+ * \param empty: if not NULL (and mutex is not NULL) waits while
+ *                the fifo is empty
+ */
+int drain_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Same as drain_fifo(), but detaches at most max elements.
+ */
+int pop_many_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, int max, pthread_mutex_t* mutex, pthread_cond_t* empty);
+
+/*
+ * \brief Remove the first element of a detached chain. No lock is needed,
+ *                since the chain is owned by the thread that detached it.
+ * \returns 1 if an element has been removed and written in elem,
+ *                0 if the chain is empty.
+ * \param chain : chain filled by drain_fifo() or pop_many_fifo()
+ * \param elem : where the removed element will be written
+ */
+int pop_chain(fifo_chain_t* chain, void** elem);
+
+/*
+ * \brief Gives back to the pool of the fifo, in O(1), the nodes of a
+ *                chain already walked with pop_chain(). Every element
+ *                must have been removed from the chain.
+ * \param fifo : fifo the chain has been detached from
+ * \param chain : chain filled by drain_fifo() or pop_many_fifo()
+ * \param mutex: mutual exclusion for sharing fifo between threads
+ */
+void release_chain_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex);
+
+/*
+ * \brief Remove, if present, remaining elements and the nodes
+ *                left in the pool. Elements pushed with an embedded
+ *                node are not freed.
  * \param fifo : pointer to pointer to double_ended linked list
  */
 void free_fifo(fifo_unbounded_t* fifo);
@@ -56,4 +238,20 @@ void free_fifo(fifo_unbounded_t* fifo);
  */
 int get_count_fifo(fifo_unbounded_t* fifo, pthread_mutex_t* mutex);
 
+/*
+ * \brief returns the last number of elements published by the fifo,
+ *                without taking its lock. The value may be already
+ *                old when it is used.
+ * \param fifo : pointer to pointer to double_ended linked list
+ */
+int get_depth_fifo(fifo_unbounded_t* fifo);
+
+/*
+ * \brief copies the allocation statistics of the node pool
+ * \param fifo : pointer to double_ended linked list
+ * \param stats : where the statistics will be copied
+ * \param mutex: mutual exclusion for sharing fifo between threads
+ */
+void get_stats_fifo(fifo_unbounded_t* fifo, struct __fifo_stats* stats, pthread_mutex_t* mutex);
+
 #endif
@@ -0,0 +1,106 @@
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+struct __xlog;
+
+//Buckets of HISTOGRAM_BUCKET_MSECS milliseconds each. The last
+//  bucket also counts every value past the end of the histogram.
+#define HISTOGRAM_BUCKET_MSECS 10
+#define HISTOGRAM_BUCKETS 512
+
+//Values recorded by many threads without locking, each
+//  bucket is only ever increased.
+typedef struct __histogram{
+  long counts[HISTOGRAM_BUCKETS];
+}histogram_t;
+
+//Values recorded in a histogram during the last rounds only. Owned by
+//  a single thread, which moves the window one round at a time.
+typedef struct __rolling_histogram{
+  //Sum of the rounds inside the window
+  long window[HISTOGRAM_BUCKETS];
+  long window_count;
+  //Values added in each round of the window, as a ring
+  long (*rounds)[HISTOGRAM_BUCKETS];
+  int rounds_count;
+  int next_round;
+  //Counts of the shared histogram when last read
+  long last[HISTOGRAM_BUCKETS];
+}rolling_histogram_t;
+
+/*
+ * \brief Initialization of an empty histogram.
+ */
+void histogram_init(histogram_t* histogram);
+
+/*
+ * \brief Counts a value in milliseconds. Can be called by any thread.
+ */
+void histogram_record(histogram_t* histogram, long msecs);
+
+/*
+ * \brief Dynamic initialization of a rolling histogram of the values
+ *                recorded in histogram during the last rounds_count rounds.
+ */
+void rolling_histogram_init(rolling_histogram_t* rolling, histogram_t* histogram, int rounds_count);
+
+void rolling_histogram_free(rolling_histogram_t* rolling);
+
+/*
+ * \brief Ends a round: the values recorded in histogram since the last
+ *                call enter the window, and the oldest round leaves it.
+ */
+void rolling_histogram_update(rolling_histogram_t* rolling, histogram_t* histogram);
+
+/*
+ * \brief Value in milliseconds below which are percentile percent
+ *                of the values in the window, rounded up to the end of
+ *                its bucket. 0 if the window is empty.
+ */
+long rolling_histogram_percentile(rolling_histogram_t* rolling, int percentile);
+
+
+//Log-linear histogram of latencies in microseconds: values below
+//  2*LATENCY_SUB_BUCKETS have a bucket each, then every power of two
+//  is split in LATENCY_SUB_BUCKETS buckets, so that any value is known
+//  within 1/LATENCY_SUB_BUCKETS of itself (about 1.6%), up to 2^LATENCY_MAX_BITS
+//  microseconds (about 19 hours). Longer values count as the last bucket.
+#define LATENCY_SUB_BITS 6
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 36
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+//Recorded by many threads without locking, like histogram_t
+typedef struct __latency_histogram{
+  long counts[LATENCY_BUCKETS];
+  long count;
+  long sum;
+  long max;
+}latency_histogram_t;
+
+/*
+ * \brief Initialization of an empty latency histogram.
+ */
+void latency_histogram_init(latency_histogram_t* histogram);
+
+/*
+ * \brief Counts a value in microseconds. Can be called by any thread.
+ */
+void latency_histogram_record(latency_histogram_t* histogram, long usecs);
+
+/*
+ * \brief Value in microseconds below which are percentile percent of
+ *                the values recorded so far, rounded up to the end of its
+ *                bucket (but never above the maximum). 0 if it is empty.
+ *                Can be called while the values are being recorded.
+ */
+long latency_histogram_percentile(latency_histogram_t* histogram, double percentile);
+
+/*
+ * \brief Writes in log the header of a table of percentiles, and a row
+ *                of it for the histogram, in milliseconds.
+ */
+void latency_histogram_print_header(struct __xlog* log, const char* title);
+void latency_histogram_print(latency_histogram_t* histogram, struct __xlog* log, const char* name);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+struct __xlog;
+
+//Counters kept for the whole supermarket
+#define STATS_SERVED_CUSTOMERS 0
+#define STATS_BOUGHT_PRODUCTS 1
+//Customers moved to another queue, for any reason
+#define STATS_CHANGED_QUEUES 2
+#define STATS_CLOSURES 3
+//Customers with no products let out by the director
+#define STATS_PERMISSIONS 4
+//Customers sent away from the queue of a desk being closed
+#define STATS_EVICTIONS 5
+#define STATS_COUNTERS 6
+
+//Period in milliseconds with which the cashiers handler writes the
+//  counters in the director log while the supermarket is open
+#define STATS_REPORT_MSECS 1000
+
+//Counters of a single cashier (or of the director). Each shard has a
+//  cache line of its own, so that the cashiers never write on the
+//  same line, and a shard is mostly written by a single thread.
+struct __stats_shard{
+  long counters[STATS_COUNTERS];
+  char padding[CACHE_LINE_SIZE - STATS_COUNTERS*sizeof(long) % CACHE_LINE_SIZE];
+};
+
+typedef struct __stats{
+  struct __stats_shard* shards;
+  //One shard for each cashier, plus the last one for the director
+  int shards_count;
+}stats_t;
+
+/*
+ * \brief Dynamic initialization of the counters, all 0.
+ * \param cashiers_count: maximum number of cashiers that will add to them.
+ */
+void stats_init(stats_t* stats, int cashiers_count);
+
+void stats_free(stats_t* stats);
+
+/*
+ * \brief Adds value to a counter (STATS_*) of the shard of a cashier,
+ *                without locking. Can be called by any thread.
+ */
+void stats_add(stats_t* stats, int cashier_id, int counter, long value);
+
+/*
+ * \brief Same as stats_add(), on the shard of the director.
+ */
+void stats_add_director(stats_t* stats, int counter, long value);
+
+/*
+ * \brief Sum of a counter over every shard. Can be called at any
+ *                time, while the counters are being updated.
+ */
+long stats_read(stats_t* stats, int counter);
+
+/*
+ * \brief Reads every counter at once in totals, which must have
+ *                room for STATS_COUNTERS values.
+ */
+void stats_snapshot(stats_t* stats, long* totals);
+
+/*
+ * \brief Writes a line with every counter in log, after prefix.
+ */
+void stats_print(stats_t* stats, struct __xlog* log, const char* prefix);
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SUPERMARKET_H_
 #define SUPERMARKET_H_
 
+#include <cashier.h>
 #include <customer.h>
 #include <utils.h>
 
@@ -25,6 +26,17 @@
               break;                                          \
             }
 
+#define CHECK_GREATER_EQUAL_ZERO(original, param, char){      \
+              int converted = my_strtoi(original);            \
+              if (converted<0){                               \
+                printf("parameter \"%c\" must be an integer " \
+                        "greater or equal than zero\n", char); \
+                break;                                        \
+              }                                               \
+              param = converted;                              \
+              break;                                          \
+            }
+
 #define CHECK_GREATER_EQUAL_TEN(original, param, char){       \
               int converted = my_strtoi(original);            \
               if (converted<10){                              \
@@ -46,7 +58,7 @@
             break;                                            \
 }
 
-#define CONFIG_DEFAULTS {1,1,1,1,1,1,1,1,1,1,1,1,NULL,NULL,NULL, NULL}
+#define CONFIG_DEFAULTS {1,1,1,1,1,1,1,1,1,1,1,1,0,QUEUE_LIST,QUEUE_LIST,64,0,0,SELECT_RANDOM,0,0,0,10,0,0,SCHEDULER_THRESHOLDS,500,95,0,0,0,XLOG_OVERFLOW_BLOCK,0,0,NULL,NULL,NULL, NULL}
 
 struct __config{
   int cashiers_count;
@@ -61,6 +73,28 @@ struct __config{
   int director_too_many_customers;
   int director_below_min_limit;
   int director_above_max_limit;
+  int queue_reserved_nodes;
+  int cashiers_queue_kind;
+  int director_queue_kind;
+  int queue_capacity;
+  int customer_engine_workers;
+  int timer_wheel_enabled;
+  int selection_policy;
+  int shared_line_enabled;
+  int steal_wait;
+  int express_cashiers;
+  int express_products_limit;
+  int priority_aging;
+  int jockey_margin;
+  int scheduler;
+  int target_wait;
+  int slo_percentile;
+  int max_cashiers;
+  int customer_pool_threads;
+  int log_writer_enabled;
+  int log_overflow;
+  int binary_log_enabled;
+  int latency_snapshot;
   FILE* file_log_supermarket;
   FILE* file_log_cashiers;
   FILE* file_log_customers;
@@ -78,6 +112,13 @@ struct __entrance_args{
   queue_t* director_permissions_list;
   struct __xlog* log;
   struct __xlog* supermarket_log;
+  struct __customer_engine* engine;
+  struct __customer_pool* pool;
+  //Written by the entrance: customers let in, time spent
+  //  letting them in and longest time for a single one
+  long let_in_count;
+  long let_in_usecs;
+  long max_let_in_usecs;
 };
 
 extern volatile sig_atomic_t sighup_status;
@@ -0,0 +1,65 @@
+#ifndef TIMER_WHEEL_H_
+#define TIMER_WHEEL_H_
+
+#include <pthread.h>
+
+//The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots each. A slot of
+//  the first level lasts one tick (one millisecond), a slot of the next
+//  level lasts as much as the whole previous level.
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+//Like the nodes of the fifos, timers are allocated by the caller
+//  (usually inside the struct that waits for them) and are
+//  never freed by the wheel.
+struct __timer{
+  struct __timer* next;
+  unsigned long expires;
+  void (*callback)(void* arg);
+  void* arg;
+};
+
+typedef struct __timer_wheel{
+  //timerfd ticking every millisecond, only armed while
+  //  there are pending timers
+  int fd;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  //Last tick processed
+  unsigned long now;
+  struct __timer* slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  int pending;
+  int stop;
+  long fired;
+  long cascaded;
+}timer_wheel_t;
+
+/*
+ * \brief Dynamic initialization of the wheel and of its thread.
+ */
+timer_wheel_t* timer_wheel_init();
+
+/*
+ * \brief Schedules a callback, which will be called by the wheel thread
+ *                after the given milliseconds (at least one tick).
+ *                The callback must not wait.
+ * \param timer: timer used to keep track of the callback, must not be
+ *                modified until the callback has been called.
+ */
+void timer_wheel_add(timer_wheel_t* wheel, struct __timer* timer, int msecs,
+            void (*callback)(void* arg), void* arg);
+
+/*
+ * \brief Waits the given milliseconds, without using a kernel timer.
+ */
+void timer_wheel_sleep(timer_wheel_t* wheel, int msecs);
+
+/*
+ * \brief Stops and joins the wheel thread and frees the wheel.
+ *                Timers still pending are never called.
+ */
+void timer_wheel_free(timer_wheel_t* wheel);
+
+#endif
@@ -3,19 +3,27 @@
 
 #include <stdio.h>
 #include <fifo_unbounded.h>
+#include <fifo_mpsc.h>
+#include <fifo_ring.h>
 #include <signal.h>
+#include <xlog.h>
+
+struct __timer_wheel;
+
+//Implementations that can be used for a queue_t
+#define QUEUE_LIST 0
+#define QUEUE_MPSC 1
+#define QUEUE_RING 2
 
 typedef struct __queue{
+  int kind;
   fifo_unbounded_t* fifo;
   pthread_mutex_t* mutex;
   pthread_cond_t* empty;
+  fifo_mpsc_t* mpsc;
+  fifo_ring_t* ring;
 }queue_t;
 
-struct __xlog{
-  FILE* file;
-  pthread_mutex_t* mutex;
-};
-
 #define ERROR_AT fprintf(stderr, "%s:%d\n", __FILE__, __LINE__);
 
 #define XLOCK(mutex_address) CHECK_ERR(pthread_mutex_lock(mutex_address), "lock");
@@ -82,6 +90,8 @@ struct __xlog{
 
 #define CLOSE 0
 #define OPEN 1
+//Closed cashier whose thread has been stopped
+#define RETIRED 2
 
 #define THOUSAND 1000
 #define MILLION 1000000
@@ -89,10 +99,119 @@ struct __xlog{
 
 void* xmalloc(size_t bytes);
 
+/*
+ * \brief Dynamic initialization of a queue_t of the given kind.
+ * \param queue : queue to initialize
+ * \param kind : QUEUE_LIST (fifo_unbounded_t with mutex and condition
+ *                variable), QUEUE_MPSC (lock-free, only one thread
+ *                can pop from it) or QUEUE_RING (lock-free and bounded).
+ * \param reserved_nodes : number of nodes pre-allocated in the queue pool
+ * \param capacity : maximum number of elements of a QUEUE_RING
+ */
+void queue_init(queue_t* queue, int kind, int reserved_nodes, int capacity);
+
+/*
+ * \brief Frees the resources allocated by queue_init() and
+ *                any element left inside the queue.
+ */
+void queue_free(queue_t* queue);
+
+/*
+ * \brief Push, pop and count on the underlying queue implementation.
+ *                queue_pop() waits while the queue is empty, queue_push()
+ *                while a QUEUE_RING is full. The try versions never wait
+ *                and return 0 if the operation couldn't be done.
+ */
+void queue_push(queue_t* queue, void* elem);
+int queue_try_push(queue_t* queue, void* elem);
+void* queue_pop(queue_t* queue);
+int queue_try_pop(queue_t* queue, void** elem);
+
+/*
+ * \brief Same as queue_push() and queue_try_push(), but for elements with
+ *                an embedded node initialized by fifo_node_init(), so that
+ *                no node has to be allocated.
+ */
+void queue_push_node(queue_t* queue, struct __node* node);
+int queue_try_push_node(queue_t* queue, struct __node* node);
+
+/*
+ * \brief Same as queue_try_push_node(), but a QUEUE_LIST is kept sorted by
+ *                key, lower keys first (see push_node_sorted_fifo()).
+ *                The other kinds ignore the key and push at the tail.
+ */
+int queue_try_push_node_sorted(queue_t* queue, struct __node* node, long key);
+
+/*
+ * \brief Same as queue_pop(), but while the queue is empty it only waits as
+ *                long as *flag is not 0. After changing a flag, queue_wake_all()
+ *                must be called. Only a QUEUE_LIST can be stopped by the flag.
+ */
+void* queue_pop_while(queue_t* queue, int* flag);
+
+/*
+ * \brief Same as queue_pop(), but waits at most msecs milliseconds. Only a
+ *                QUEUE_LIST can time out, the others wait until a push.
+ * \returns 0 if the queue is still empty, 1 if elem has been written.
+ */
+int queue_pop_timed(queue_t* queue, void** elem, int msecs);
+
+/*
+ * \brief Takes the element at the tail of a QUEUE_LIST, never a NULL one.
+ * \returns 0 if there was nothing to steal or the queue is of another kind.
+ */
+int queue_steal(queue_t* queue, void** elem);
+
+/*
+ * \brief Same as queue_steal(), but takes the element at the head,
+ *                the one who has waited the most.
+ */
+int queue_steal_head(queue_t* queue, void** elem);
+void queue_wake_all(queue_t* queue);
+
+/*
+ * \brief Pushes a NULL element to wake up a thread waiting in queue_pop().
+ *                Never waits: if a bounded queue is full nobody is waiting.
+ */
+void queue_wake_up(queue_t* queue);
+
+/*
+ * \brief Number of elements in the queue, as last published by the
+ *                queue itself. Never locks, so it can be sampled often.
+ */
+int queue_count(queue_t* queue);
+void queue_stats(queue_t* queue, struct __fifo_stats* stats);
+
 int my_strtoi(char* string);
 
+/*
+ * \brief Waits the given milliseconds. If a timer wheel has been set
+ *                with nanotimer_set_wheel(), the wait is done on the
+ *                wheel instead of with a nanosleep.
+ */
 void nanotimer(int microsecs);
 
+/*
+ * \brief Sets the timer wheel used by nanotimer(), NULL to use nanosleep.
+ */
+void nanotimer_set_wheel(struct __timer_wheel* wheel);
+
 void timespec_diff(struct timespec* start, struct timespec* stop, struct timespec* result);
 
+/*
+ * \brief Milliseconds elapsed on the monotonic clock, to compare
+ *                timestamps taken by different threads.
+ */
+long monotonic_msecs();
+
+/*
+ * \brief Moves a timespec forward by the given milliseconds.
+ */
+void timespec_add_msecs(struct timespec* time, long msecs);
+
+/*
+ * \brief The timespec as a number of nanoseconds.
+ */
+long timespec_nsecs(struct timespec* time);
+
 #endif
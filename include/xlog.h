@@ -0,0 +1,76 @@
+#ifndef XLOG_H_
+#define XLOG_H_
+
+#include <stdio.h>
+#include <pthread.h>
+#include <binlog.h>
+
+//Longest line that can be written with a single xlog_printf()
+#define XLOG_LINE_MAX 512
+
+//Bytes of the ring of each thread (must be a power of two), and bytes
+//  collected for a file before the writer calls write()
+#define XLOG_RING_BYTES 16384
+#define XLOG_BATCH_BYTES 65536
+
+//Milliseconds the writer waits when it finds every ring empty
+#define XLOG_IDLE_MSECS 5
+
+//What a thread does when its ring is full
+#define XLOG_OVERFLOW_BLOCK 0
+#define XLOG_OVERFLOW_DROP 1
+
+struct __xlog{
+  FILE* file;
+  pthread_mutex_t* mutex;
+  //Position of the file in the writer, -1 if the lines are written
+  //  right away on the file (under the mutex) as before.
+  int id;
+  //If set, records are written as struct __binlog_record
+  //  instead of as lines of text.
+  int binary;
+};
+
+/*
+ * \brief Writes a line on the log, with the same format as fprintf.
+ *                If the writer has been started, the line is only copied
+ *                in the ring of the calling thread, without any lock,
+ *                and will be written by the writer thread.
+ * \param log: log initialized by the main.
+ */
+void xlog_printf(struct __xlog* log, const char* format, ...)
+      __attribute__ ((format (printf, 2, 3)));
+
+/*
+ * \brief Writes the bytes on the log as they are, in the same way
+ *                as xlog_printf. len must be less than XLOG_LINE_MAX.
+ */
+void xlog_write(struct __xlog* log, const void* data, int len);
+
+/*
+ * \brief Writes a record of the supermarket log, in binary if the log
+ *                is binary or else as a line of the text format.
+ */
+void xlog_record(struct __xlog* log, struct __binlog_record* record);
+
+/*
+ * \brief Starts the writer thread, which from now on writes the lines
+ *                of the given logs in large batches.
+ *                Each thread logging gets its own ring. The lines of the
+ *                different rings are merged on the time they were logged.
+ * \param logs: logs the writer is responsible for, must not be
+ *                written with fprintf until xlog_writer_stop.
+ * \param overflow: XLOG_OVERFLOW_BLOCK if a thread with a full ring waits
+ *                for the writer, XLOG_OVERFLOW_DROP if the line is lost.
+ */
+void xlog_writer_start(struct __xlog** logs, int count, int overflow);
+
+/*
+ * \brief Writes everything left in the rings, stops the writer thread and
+ *                frees the rings. Lines written after this call are written
+ *                right away on the file, as if the writer was never started.
+ * \param stats_log: if not NULL, where the statistics of the writer are written.
+ */
+void xlog_writer_stop(struct __xlog* stats_log);
+
+#endif
@@ -0,0 +1,635 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <binlog.h>
+
+/*
+ * Native version of script/analisi.sh: prints the same customers and
+ *  cashiers tables, plus the percentiles of the times, for a supermarket
+ *  log in the text or in the binary format.
+ * The log is mapped in memory and split in chunks, each parsed by its
+ *  own thread. The results of the chunks are merged in file order, so
+ *  the output doesn't depend on the number of threads.
+ *
+ *    supermarket-analyze [-f text|csv|json] [-j threads] [log]
+ */
+
+#define DEFAULT_LOG "./logs/supermarket.log"
+#define MAX_THREADS 64
+
+#define FORMAT_TEXT 0
+#define FORMAT_CSV 1
+#define FORMAT_JSON 2
+
+//Times are kept in milliseconds, as they are written in the text log
+struct __customer_row{
+  int id;
+  int products;
+  long msecs_in_supermarket;
+  long msecs_in_queue;
+  int changed_queues;
+};
+
+struct __cashier_stats{
+  //Last K record of the chunk, if any: a later one replaces it
+  int has_record;
+  int served_customers;
+  int products;
+  int closures;
+  long msecs_serving;
+  long msecs_open;
+};
+
+struct __chunk{
+  pthread_t thread;
+  //Text lines from begin to end, or binary records
+  const char* begin;
+  const char* end;
+  int binary;
+  struct __customer_row* customers;
+  long customers_count;
+  long customers_size;
+  //Service time of each KC record
+  long* served;
+  long served_count;
+  long served_size;
+  struct __cashier_stats* cashiers;
+  int cashiers_size;
+};
+
+
+static void* xrealloc(void* pointer, size_t bytes){
+
+  void* res = realloc(pointer, bytes);
+  if (!res){
+    fprintf(stderr, "Realloc couldn't allocate %ld bytes\n", bytes);
+    exit(EXIT_FAILURE);
+  }
+
+  return res;
+
+}
+
+
+static struct __cashier_stats* chunk_cashier(struct __chunk* chunk, int id){
+
+  if (id < 0) id = 0;
+
+  if (id >= chunk->cashiers_size){
+    int size = chunk->cashiers_size ? chunk->cashiers_size : 16;
+    while (size <= id) size *= 2;
+    chunk->cashiers = xrealloc(chunk->cashiers, sizeof(struct __cashier_stats)*size);
+    memset(chunk->cashiers + chunk->cashiers_size, 0,
+              sizeof(struct __cashier_stats)*(size - chunk->cashiers_size));
+    chunk->cashiers_size = size;
+  }
+
+  return &chunk->cashiers[id];
+
+}
+
+
+static void add_customer(struct __chunk* chunk, struct __customer_row* row){
+
+  if (chunk->customers_count == chunk->customers_size){
+    chunk->customers_size = chunk->customers_size ? chunk->customers_size*2 : 1024;
+    chunk->customers = xrealloc(chunk->customers, sizeof(struct __customer_row)*chunk->customers_size);
+  }
+
+  chunk->customers[chunk->customers_count++] = *row;
+
+}
+
+
+static void add_served(struct __chunk* chunk, int cashier_id, long msecs){
+
+  if (chunk->served_count == chunk->served_size){
+    chunk->served_size = chunk->served_size ? chunk->served_size*2 : 1024;
+    chunk->served = xrealloc(chunk->served, sizeof(long)*chunk->served_size);
+  }
+
+  chunk->served[chunk->served_count++] = msecs;
+  chunk_cashier(chunk, cashier_id)->msecs_serving += msecs;
+
+}
+
+
+static void set_cashier(struct __chunk* chunk, int id, int served_customers, int products, int closures){
+
+  struct __cashier_stats* stats = chunk_cashier(chunk, id);
+  stats->has_record = 1;
+  stats->served_customers = served_customers;
+  stats->products = products;
+  stats->closures = closures;
+
+}
+
+
+// --- TEXT FORMAT ---
+
+//The fields are separated by a tab, a missing field reads as 0
+static const char* parse_int(const char* p, const char* end, long* value){
+
+  int negative = 0;
+  *value = 0;
+
+  if (p < end && *p == '\t') p++;
+  if (p < end && *p == '-'){
+    negative = 1;
+    p++;
+  }
+  while (p < end && *p >= '0' && *p <= '9'){
+    *value = *value*10 + (*p - '0');
+    p++;
+  }
+  if (negative) *value = -*value;
+
+  return p;
+
+}
+
+
+//"%ld.%03lu" as milliseconds
+static const char* parse_msecs(const char* p, const char* end, long* msecs){
+
+  long secs = 0;
+  p = parse_int(p, end, &secs);
+  *msecs = secs*1000;
+
+  if (p < end && *p == '.'){
+    p++;
+    long thousandths = 0;
+    int digits = 0;
+    while (p < end && *p >= '0' && *p <= '9'){
+      if (digits < 3){
+        thousandths = thousandths*10 + (*p - '0');
+        digits++;
+      }
+      p++;
+    }
+    while (digits++ < 3) thousandths *= 10;
+    *msecs += secs < 0 ? -thousandths : thousandths;
+  }
+
+  return p;
+
+}
+
+
+static void parse_line(struct __chunk* chunk, const char* p, const char* end){
+
+  long a = 0, b = 0, c = 0, d = 0;
+
+  if (end-p >= 2 && p[0] == 'C' && p[1] == '\t'){
+
+    struct __customer_row row;
+    p = parse_int(p+1, end, &a);
+    p = parse_msecs(p, end, &row.msecs_in_supermarket);
+    p = parse_msecs(p, end, &row.msecs_in_queue);
+    p = parse_int(p, end, &b);
+    p = parse_int(p, end, &c);
+    row.id = a;
+    row.changed_queues = b;
+    row.products = c;
+    add_customer(chunk, &row);
+
+  } else if (end-p >= 2 && p[0] == 'K' && p[1] == '\t'){
+
+    p = parse_int(p+1, end, &a);
+    p = parse_int(p, end, &b);
+    p = parse_int(p, end, &c);
+    p = parse_int(p, end, &d);
+    set_cashier(chunk, a, b, c, d);
+
+  } else if (end-p >= 3 && p[0] == 'K' && p[1] == 'C' && p[2] == '\t'){
+
+    p = parse_int(p+2, end, &a);
+    p = parse_int(p, end, &b);
+    p = parse_msecs(p, end, &c);
+    add_served(chunk, a, c);
+
+  } else if (end-p >= 3 && p[0] == 'K' && p[1] == 'S' && p[2] == '\t'){
+
+    p = parse_int(p+2, end, &a);
+    p = parse_msecs(p, end, &b);
+    chunk_cashier(chunk, a)->msecs_open += b;
+
+  }
+
+}
+
+
+// --- BINARY FORMAT ---
+
+#define MSECS(record, index) (binlog_nsecs(record, index)/1000000)
+
+static void parse_record(struct __chunk* chunk, const struct __binlog_record* record){
+
+  struct __customer_row row;
+
+  switch (record->type){
+
+    case BINLOG_CUSTOMER:
+      row.id = record->id;
+      row.products = record->count;
+      row.msecs_in_supermarket = MSECS(record, 0);
+      row.msecs_in_queue = MSECS(record, 1);
+      row.changed_queues = record->changed_queues;
+      add_customer(chunk, &row);
+      break;
+
+    case BINLOG_SERVED:
+      add_served(chunk, record->id, MSECS(record, 0));
+      break;
+
+    case BINLOG_WORKSHIFT:
+      chunk_cashier(chunk, record->id)->msecs_open += MSECS(record, 0);
+      break;
+
+    case BINLOG_CASHIER:
+      set_cashier(chunk, record->id, record->count, record->counts[0], record->counts[1]);
+      break;
+
+  }
+
+}
+
+
+static void* parse_chunk(void* args_pointer){
+
+  struct __chunk* chunk = (struct __chunk*)args_pointer;
+
+  if (chunk->binary){
+
+    //The headers between the runs are skipped
+    const char* p = chunk->begin;
+    while (p + sizeof(struct __binlog_record) <= chunk->end){
+      const struct __binlog_header* header = (const struct __binlog_header*)p;
+      if (header->magic != BINLOG_MAGIC) parse_record(chunk, (const struct __binlog_record*)p);
+      p += sizeof(struct __binlog_record);
+    }
+
+  } else {
+
+    const char* p = chunk->begin;
+    while (p < chunk->end){
+      const char* line_end = memchr(p, '\n', chunk->end - p);
+      if (!line_end) line_end = chunk->end;
+      parse_line(chunk, p, line_end);
+      p = line_end+1;
+    }
+
+  }
+
+  return NULL;
+
+}
+
+
+// --- RESULTS ---
+
+static int compare_long(const void* a, const void* b){
+
+  long x = *(const long*)a;
+  long y = *(const long*)b;
+  return (x > y) - (x < y);
+
+}
+
+
+//Nearest rank percentile of sorted values
+static long percentile(long* values, long count, int p){
+
+  if (count == 0) return 0;
+
+  long rank = (count*p + 99) / 100;
+  if (rank < 1) rank = 1;
+  return values[rank-1];
+
+}
+
+
+struct __distribution{
+  const char* name;
+  long* values;
+  long count;
+};
+
+static const int percentiles[] = {50, 90, 99};
+#define PERCENTILES_COUNT ((int)(sizeof(percentiles)/sizeof(int)))
+
+
+static void print_text(struct __chunk* chunks, int chunks_count, struct __cashier_stats* cashiers,
+            int cashiers_count, struct __distribution* distributions, int distributions_count){
+
+  printf("Customers:\n");
+  printf("┌────────┬────────┬────────┬────────┬────────┐\n");
+  printf("│   ID   │ #PRODS │SPRMTIME│SRVSTIME│ #QUEUE │\n");
+  printf("├────────┼────────┼────────┼────────┼────────┤\n");
+  for (int i = 0; i<chunks_count; i++){
+    for (long j = 0; j<chunks[i].customers_count; j++){
+      struct __customer_row* row = &chunks[i].customers[j];
+      printf("│ %6d │ %6d │ %6.3f │ %6.3f │ %6d │\n", row->id, row->products,
+                row->msecs_in_supermarket/1000.0, row->msecs_in_queue/1000.0, row->changed_queues);
+    }
+  }
+  printf("└────────┴────────┴────────┴────────┴────────┘\n");
+
+  printf("\n");
+  printf("Cashiers: \n");
+  printf("┌────────┬────────┬────────┬────────┬────────┬────────┐\n");
+  printf("│   ID   │ #PRODS │#CUSTMRS│OPENTIME│AVGSERVC│ #CLOSE │\n");
+  printf("├────────┼────────┼────────┼────────┼────────┼────────┤\n");
+  for (int i = 0; i<cashiers_count; i++){
+    struct __cashier_stats* stats = &cashiers[i];
+    double average = stats->served_customers ? stats->msecs_serving/1000.0/stats->served_customers : 0;
+    printf("│ %6d │ %6d │ %6d │ %6.3f │ %6.3f │ %6d │\n", i, stats->products,
+              stats->served_customers, stats->msecs_open/1000.0, average, stats->closures);
+  }
+  printf("└────────┴────────┴────────┴────────┴────────┴────────┘\n");
+
+  printf("\n");
+  printf("Percentiles: \n");
+  printf("┌────────┬────────┬────────┬────────┬────────┐\n");
+  printf("│        │ COUNT  │  P50   │  P90   │  P99   │\n");
+  printf("├────────┼────────┼────────┼────────┼────────┤\n");
+  for (int i = 0; i<distributions_count; i++){
+    struct __distribution* d = &distributions[i];
+    printf("│%-8s│%7ld │", d->name, d->count);
+    for (int p = 0; p<PERCENTILES_COUNT; p++){
+      printf(" %6.3f │", percentile(d->values, d->count, percentiles[p])/1000.0);
+    }
+    printf("\n");
+  }
+  printf("└────────┴────────┴────────┴────────┴────────┘\n");
+
+}
+
+
+static void print_csv(struct __chunk* chunks, int chunks_count, struct __cashier_stats* cashiers,
+            int cashiers_count, struct __distribution* distributions, int distributions_count){
+
+  printf("customer_id,products,time_in_supermarket,time_in_queue,changed_queues\n");
+  for (int i = 0; i<chunks_count; i++){
+    for (long j = 0; j<chunks[i].customers_count; j++){
+      struct __customer_row* row = &chunks[i].customers[j];
+      printf("%d,%d,%.3f,%.3f,%d\n", row->id, row->products,
+                row->msecs_in_supermarket/1000.0, row->msecs_in_queue/1000.0, row->changed_queues);
+    }
+  }
+
+  printf("\ncashier_id,products,served_customers,time_open,average_service_time,closures\n");
+  for (int i = 0; i<cashiers_count; i++){
+    struct __cashier_stats* stats = &cashiers[i];
+    double average = stats->served_customers ? stats->msecs_serving/1000.0/stats->served_customers : 0;
+    printf("%d,%d,%d,%.3f,%.3f,%d\n", i, stats->products, stats->served_customers,
+              stats->msecs_open/1000.0, average, stats->closures);
+  }
+
+  printf("\ntime,count,p50,p90,p99\n");
+  for (int i = 0; i<distributions_count; i++){
+    struct __distribution* d = &distributions[i];
+    printf("%s,%ld", d->name, d->count);
+    for (int p = 0; p<PERCENTILES_COUNT; p++){
+      printf(",%.3f", percentile(d->values, d->count, percentiles[p])/1000.0);
+    }
+    printf("\n");
+  }
+
+}
+
+
+static void print_json(struct __chunk* chunks, int chunks_count, struct __cashier_stats* cashiers,
+            int cashiers_count, struct __distribution* distributions, int distributions_count){
+
+  printf("{\n  \"customers\": [");
+  int first = 1;
+  for (int i = 0; i<chunks_count; i++){
+    for (long j = 0; j<chunks[i].customers_count; j++){
+      struct __customer_row* row = &chunks[i].customers[j];
+      printf("%s\n    {\"id\": %d, \"products\": %d, \"time_in_supermarket\": %.3f, "
+                "\"time_in_queue\": %.3f, \"changed_queues\": %d}", first ? "" : ",", row->id,
+                row->products, row->msecs_in_supermarket/1000.0, row->msecs_in_queue/1000.0,
+                row->changed_queues);
+      first = 0;
+    }
+  }
+
+  printf("\n  ],\n  \"cashiers\": [");
+  for (int i = 0; i<cashiers_count; i++){
+    struct __cashier_stats* stats = &cashiers[i];
+    double average = stats->served_customers ? stats->msecs_serving/1000.0/stats->served_customers : 0;
+    printf("%s\n    {\"id\": %d, \"products\": %d, \"served_customers\": %d, \"time_open\": %.3f, "
+              "\"average_service_time\": %.3f, \"closures\": %d}", i ? "," : "", i, stats->products,
+              stats->served_customers, stats->msecs_open/1000.0, average, stats->closures);
+  }
+
+  printf("\n  ],\n  \"percentiles\": {");
+  for (int i = 0; i<distributions_count; i++){
+    struct __distribution* d = &distributions[i];
+    printf("%s\n    \"%s\": {\"count\": %ld", i ? "," : "", d->name, d->count);
+    for (int p = 0; p<PERCENTILES_COUNT; p++){
+      printf(", \"p%d\": %.3f", percentiles[p], percentile(d->values, d->count, percentiles[p])/1000.0);
+    }
+    printf("}");
+  }
+  printf("\n  }\n}\n");
+
+}
+
+
+int main(int argc, char** argv){
+
+  int format = FORMAT_TEXT;
+  long threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* path = DEFAULT_LOG;
+
+  int option = 0;
+  while ((option = getopt(argc, argv, "f:j:")) != -1){
+    switch (option){
+      case 'f':
+        if (!strcmp(optarg, "text")) format = FORMAT_TEXT;
+        else if (!strcmp(optarg, "csv")) format = FORMAT_CSV;
+        else if (!strcmp(optarg, "json")) format = FORMAT_JSON;
+        else {
+          fprintf(stderr, "unknown format \"%s\"\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'j':
+        threads_count = strtol(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-f text|csv|json] [-j threads] [log]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (optind < argc) path = argv[optind];
+  if (threads_count < 1) threads_count = 1;
+  if (threads_count > MAX_THREADS) threads_count = MAX_THREADS;
+
+  // --- MAPPING THE LOG ---
+  int fd = open(path, O_RDONLY);
+  if (fd == -1){
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) == -1){
+    perror("fstat");
+    exit(EXIT_FAILURE);
+  }
+
+  const char* data = NULL;
+  size_t size = info.st_size;
+  if (size > 0){
+    data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED){
+      perror("mmap");
+      exit(EXIT_FAILURE);
+    }
+  }
+  close(fd);
+
+  const struct __binlog_header* header = (const struct __binlog_header*)data;
+  int binary = size >= sizeof(struct __binlog_header) && header->magic == BINLOG_MAGIC;
+  if (binary && (header->version != BINLOG_VERSION || header->record_size != sizeof(struct __binlog_record))){
+    fprintf(stderr, "%s: unsupported binary log version %d\n", path, header->version);
+    exit(EXIT_FAILURE);
+  }
+  // -----------------------
+
+  // --- PARSING THE CHUNKS ---
+  //Chunks end on a line (or record) boundary
+  struct __chunk chunks[MAX_THREADS];
+  memset(chunks, 0, sizeof(chunks));
+  int chunks_count = 0;
+  const char* begin = data;
+  const char* end = data + size;
+
+  for (int i = 0; i<threads_count && begin < end; i++){
+
+    const char* chunk_end = end;
+    if (i < threads_count-1){
+      size_t length = (end - begin) / (threads_count - i);
+      if (binary){
+        length -= length % sizeof(struct __binlog_record);
+        chunk_end = begin + length;
+      } else {
+        chunk_end = memchr(begin + length, '\n', end - (begin + length));
+        chunk_end = chunk_end ? chunk_end+1 : end;
+      }
+      if (chunk_end <= begin) continue;
+    }
+
+    chunks[chunks_count].begin = begin;
+    chunks[chunks_count].end = chunk_end;
+    chunks[chunks_count].binary = binary;
+    chunks_count++;
+    begin = chunk_end;
+
+  }
+
+  for (int i = 0; i<chunks_count; i++){
+    int err = pthread_create(&chunks[i].thread, NULL, parse_chunk, &chunks[i]);
+    if (err){
+      errno = err;
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (int i = 0; i<chunks_count; i++){
+    pthread_join(chunks[i].thread, NULL);
+  }
+  // --------------------------
+
+  // --- MERGING THE CHUNKS ---
+  //As in the script, a K record replaces the previous one of the cashier,
+  //  while the KC and KS records of all the runs are summed
+  int cashiers_count = 0;
+  for (int i = 0; i<chunks_count; i++){
+    if (chunks[i].cashiers_size > cashiers_count) cashiers_count = chunks[i].cashiers_size;
+  }
+
+  struct __cashier_stats* cashiers = calloc(cashiers_count ? cashiers_count : 1, sizeof(struct __cashier_stats));
+  for (int i = 0; i<chunks_count; i++){
+    for (int j = 0; j<chunks[i].cashiers_size; j++){
+      struct __cashier_stats* stats = &chunks[i].cashiers[j];
+      if (stats->has_record){
+        cashiers[j].has_record = 1;
+        cashiers[j].served_customers = stats->served_customers;
+        cashiers[j].products = stats->products;
+        cashiers[j].closures = stats->closures;
+      }
+      cashiers[j].msecs_serving += stats->msecs_serving;
+      cashiers[j].msecs_open += stats->msecs_open;
+    }
+  }
+
+  //Only the cashiers up to the last one with a K record are printed
+  while (cashiers_count > 0 && !cashiers[cashiers_count-1].has_record) cashiers_count--;
+
+  long customers_count = 0;
+  long served_count = 0;
+  for (int i = 0; i<chunks_count; i++){
+    customers_count += chunks[i].customers_count;
+    served_count += chunks[i].served_count;
+  }
+
+  struct __distribution distributions[3] = {
+    {"store", malloc(sizeof(long)*(customers_count+1)), customers_count},
+    {"queue", malloc(sizeof(long)*(customers_count+1)), customers_count},
+    {"service", malloc(sizeof(long)*(served_count+1)), served_count},
+  };
+
+  long k = 0;
+  long s = 0;
+  for (int i = 0; i<chunks_count; i++){
+    for (long j = 0; j<chunks[i].customers_count; j++){
+      distributions[0].values[k] = chunks[i].customers[j].msecs_in_supermarket;
+      distributions[1].values[k] = chunks[i].customers[j].msecs_in_queue;
+      k++;
+    }
+    memcpy(distributions[2].values + s, chunks[i].served, sizeof(long)*chunks[i].served_count);
+    s += chunks[i].served_count;
+  }
+
+  for (int i = 0; i<3; i++){
+    qsort(distributions[i].values, distributions[i].count, sizeof(long), compare_long);
+  }
+  // --------------------------
+
+  //The customers table alone may be millions of lines
+  static char output_buffer[1 << 20];
+  setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+
+  if (format == FORMAT_CSV) print_csv(chunks, chunks_count, cashiers, cashiers_count, distributions, 3);
+  else if (format == FORMAT_JSON) print_json(chunks, chunks_count, cashiers, cashiers_count, distributions, 3);
+  else print_text(chunks, chunks_count, cashiers, cashiers_count, distributions, 3);
+
+  if (fflush(stdout)) perror("fflush");
+
+  for (int i = 0; i<chunks_count; i++){
+    free(chunks[i].customers);
+    free(chunks[i].served);
+    free(chunks[i].cashiers);
+  }
+  for (int i = 0; i<3; i++){
+    free(distributions[i].values);
+  }
+  free(cashiers);
+  if (data) munmap((void*)data, size);
+
+  return 0;
+
+}
@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <binlog.h>
+
+#define BILLION 1000000000L
+#define MILLION 1000000L
+
+//Headers and records are blocks of the same size
+_Static_assert(sizeof(struct __binlog_header) == sizeof(struct __binlog_record),
+          "binlog header and record must have the same size");
+
+
+void binlog_header_init(struct __binlog_header* header){
+
+  memset(header, 0, sizeof(struct __binlog_header));
+  header->magic = BINLOG_MAGIC;
+  header->version = BINLOG_VERSION;
+  header->record_size = sizeof(struct __binlog_record);
+
+}
+
+
+static void set_nsecs(struct __binlog_record* record, int index, int64_t nsecs){
+
+  record->nsecs.low[index] = (uint32_t)nsecs;
+  record->nsecs.high[index] = (uint16_t)(nsecs >> 32);
+
+}
+
+
+int64_t binlog_nsecs(const struct __binlog_record* record, int index){
+
+  return ((int64_t)record->nsecs.high[index] << 32) | record->nsecs.low[index];
+
+}
+
+
+static void record_init(struct __binlog_record* record, int type, int id, int count){
+
+  memset(record, 0, sizeof(struct __binlog_record));
+  record->type = type;
+  record->id = id;
+  record->count = count;
+
+}
+
+
+void binlog_customer(struct __binlog_record* record, int id, int changed_queues, int products,
+          int64_t nsecs_in_supermarket, int64_t nsecs_in_queue){
+
+  record_init(record, BINLOG_CUSTOMER, id, products);
+  record->changed_queues = changed_queues < UINT16_MAX ? changed_queues : UINT16_MAX;
+  set_nsecs(record, 0, nsecs_in_supermarket);
+  set_nsecs(record, 1, nsecs_in_queue);
+
+}
+
+
+void binlog_served(struct __binlog_record* record, int cashier_id, int customer_id, int64_t nsecs){
+
+  record_init(record, BINLOG_SERVED, cashier_id, customer_id);
+  set_nsecs(record, 0, nsecs);
+
+}
+
+
+void binlog_workshift(struct __binlog_record* record, int cashier_id, int64_t nsecs){
+
+  record_init(record, BINLOG_WORKSHIFT, cashier_id, 0);
+  set_nsecs(record, 0, nsecs);
+
+}
+
+
+void binlog_cashier(struct __binlog_record* record, int cashier_id, int served_customers,
+          int products, int closures){
+
+  record_init(record, BINLOG_CASHIER, cashier_id, served_customers);
+  record->counts[0] = products;
+  record->counts[1] = closures;
+
+}
+
+
+void binlog_totals(struct __binlog_record* record, int served_customers, int products){
+
+  record_init(record, BINLOG_TOTALS, 0, served_customers);
+  record->counts[0] = products;
+
+}
+
+
+static int valid_header(const struct __binlog_header* header){
+
+  return header->magic == BINLOG_MAGIC && header->version == BINLOG_VERSION
+            && header->record_size == sizeof(struct __binlog_record);
+
+}
+
+
+//Same "%ld.%03lu" of the text format, which truncates to milliseconds
+#define SECS(nsecs) (long)((nsecs)/BILLION), (unsigned long)((nsecs)%BILLION/MILLION)
+
+int binlog_format(const struct __binlog_record* record, char* buffer, size_t size){
+
+  switch (record->type){
+
+    case BINLOG_CUSTOMER:
+      return snprintf(buffer, size, "C\t%d\t%ld.%03lu\t%ld.%03lu\t%d\t%d\n", record->id,
+                SECS(binlog_nsecs(record, 0)), SECS(binlog_nsecs(record, 1)),
+                record->changed_queues, record->count);
+
+    case BINLOG_SERVED:
+      return snprintf(buffer, size, "KC\t%d\t%d\t%ld.%03lu\n", record->id, record->count,
+                SECS(binlog_nsecs(record, 0)));
+
+    case BINLOG_WORKSHIFT:
+      return snprintf(buffer, size, "KS\t%d\t%ld.%03lu\n", record->id, SECS(binlog_nsecs(record, 0)));
+
+    case BINLOG_CASHIER:
+      return snprintf(buffer, size, "K\t%d\t%d\t%d\t%d\n", record->id, record->count,
+                record->counts[0], record->counts[1]);
+
+    case BINLOG_TOTALS:
+      return snprintf(buffer, size, "Served Customers: %d\nBought products: %d\n",
+                record->count, record->counts[0]);
+
+    default:
+      if (size > 0) buffer[0] = '\0';
+      return 0;
+
+  }
+
+}
+
+
+int binlog_open(binlog_reader_t* reader, const char* path){
+
+  reader->data = NULL;
+  reader->size = 0;
+  reader->position = 0;
+  reader->runs = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return -1;
+
+  struct stat info;
+  if (fstat(fd, &info) == -1){
+    close(fd);
+    return -1;
+  }
+
+  if (info.st_size < sizeof(struct __binlog_header)){
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  //The mapping stays valid after the file is closed
+  void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return -1;
+
+  //The records are read once, from the first to the last
+  posix_madvise(data, info.st_size, POSIX_MADV_SEQUENTIAL);
+
+  if (!valid_header(data)){
+    munmap(data, info.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+
+  reader->data = data;
+  reader->size = info.st_size;
+
+  return 0;
+
+}
+
+
+const struct __binlog_record* binlog_next(binlog_reader_t* reader){
+
+  //A record cut by the end of the run is ignored
+  while (reader->position + sizeof(struct __binlog_record) <= reader->size){
+
+    const struct __binlog_record* record =
+              (const struct __binlog_record*)(reader->data + reader->position);
+    reader->position += sizeof(struct __binlog_record);
+
+    const struct __binlog_header* header = (const struct __binlog_header*)record;
+    if (header->magic != BINLOG_MAGIC) return record;
+
+    if (!valid_header(header)) return NULL;
+    reader->runs++;
+
+  }
+
+  return NULL;
+
+}
+
+
+void binlog_close(binlog_reader_t* reader){
+
+  if (reader->data) munmap((void*)reader->data, reader->size);
+  reader->data = NULL;
+
+}
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <time.h>
+
+#include <binlog.h>
+
+
+//Converts a binary supermarket log (written with b=1) to the text
+//  format, on the standard output:
+//    binlog_convert ./logs/supermarket.log > supermarket.txt
+int main(int argc, char** argv){
+
+  if (argc != 2){
+    fprintf(stderr, "usage: %s <binary supermarket log>\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  binlog_reader_t reader;
+  if (binlog_open(&reader, argv[1]) == -1){
+    perror(argv[1]);
+    exit(EXIT_FAILURE);
+  }
+
+  long records = 0;
+  char line[256];
+  const struct __binlog_record* record = NULL;
+  while ( (record = binlog_next(&reader)) ){
+    int len = binlog_format(record, line, sizeof(line));
+    if (len > 0) fwrite(line, 1, len, stdout);
+    records++;
+  }
+
+  int runs = reader.runs;
+  binlog_close(&reader);
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  long usecs = (end.tv_sec - start.tv_sec)*1000000L + (end.tv_nsec - start.tv_nsec)/1000;
+
+  fprintf(stderr, "%ld records (%d runs) converted in %ld.%03ld ms\n",
+            records, runs, usecs/1000, usecs%1000);
+
+  if (fflush(stdout)) perror("fflush");
+
+  return 0;
+
+}
@@ -4,6 +4,7 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -15,22 +16,26 @@
 
 
 cashier_t* cashier_init(int id, int initial_open_cashiers, int variable_service_time, struct __xlog* log,
-  int report_to_director_frequency, struct __customers_counter* customers_counter, unsigned int* supermarket_seed,
-  struct __xlog* supermarket_log, int* served_customers_count, int* bought_products_count){
-
-  //This queue is the one used by customers
-  queue_t* queue = xmalloc(sizeof(queue_t));
-  queue->fifo = xmalloc(sizeof(fifo_unbounded_t));
-  fifo_init(queue->fifo);
-  queue->mutex = xmalloc(sizeof(pthread_mutex_t));
-  CHECK_ERR(pthread_mutex_init(queue->mutex, NULL), "mutex init");
-  queue->empty = xmalloc(sizeof(pthread_cond_t));
-  CHECK_ERR(pthread_cond_init(queue->empty, NULL), "cond init");
+  struct __customers_counter* customers_counter, unsigned int* supermarket_seed,
+  struct __xlog* supermarket_log, int queue_kind, int queue_reserved_nodes, int queue_capacity, struct __all_cashiers* all_cashiers){
+
+  struct __shared_line* shared_line = all_cashiers->shared_line;
+
+  //This queue is the one used by customers. With a single shared
+  //  line every cashier consumes from the same queue.
+  queue_t* queue = NULL;
+  if (shared_line){
+    queue = &shared_line->queue;
+  } else {
+    queue = xmalloc(sizeof(queue_t));
+    queue_init(queue, queue_kind, queue_reserved_nodes, queue_capacity);
+  }
 
   //Status must be protected by mutex because
   //  it can be modified by the cashiers handler. 
   int* status = xmalloc(sizeof(int));
-  if (id<initial_open_cashiers){
+  //Customers with a few products must always find an express desk
+  if (id<initial_open_cashiers || (id == all_cashiers->express_first && id < all_cashiers->express_end)){
     *(status) = OPEN;
   } else {
     *(status) = CLOSE;
@@ -40,12 +45,20 @@ cashier_t* cashier_init(int id, int initial_open_cashiers, int variable_service_
   pthread_cond_t* status_closed = xmalloc(sizeof(pthread_cond_t));
   CHECK_ERR(pthread_cond_init(status_closed, NULL), "cond init");
 
-  //This struct is shared between the cashiers
-  //  handler and the report to director thread.
-  struct __cashier_director_comm* queue_customers_count = xmalloc(sizeof(struct __cashier_director_comm));
-  queue_customers_count->count = -1;
-  queue_customers_count->mutex = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
-  queue_customers_count->old_value = (pthread_cond_t)PTHREAD_COND_INITIALIZER;
+  //Written by the cashier only, read by the cashiers handler
+  long* heartbeat = xmalloc(sizeof(long));
+  *heartbeat = monotonic_msecs();
+  long* service_end = xmalloc(sizeof(long));
+  *service_end = 0;
+
+  //Updated by whoever pushes or pops a customer
+  long* pending_products = NULL;
+  if (shared_line){
+    pending_products = &shared_line->pending_products;
+  } else {
+    pending_products = xmalloc(sizeof(long));
+    *pending_products = 0;
+  }
 
 
   struct __cashier_args* args = xmalloc(sizeof(struct __cashier_args));
@@ -57,13 +70,14 @@ cashier_t* cashier_init(int id, int initial_open_cashiers, int variable_service_
   args->status = status;
   args->status_mutex = status_mutex;
   args->status_closed = status_closed;
-  args->queue_customers_count = queue_customers_count;
-  args->report_to_director_frequency = report_to_director_frequency;
+  args->heartbeat = heartbeat;
+  args->service_end = service_end;
+  args->pending_products = pending_products;
   args->customers_counter = customers_counter;
   args->log = log;
   args->supermarket_log = supermarket_log;
-  args->served_customers_count = served_customers_count;
-  args->bought_products_count = bought_products_count;
+  args->queue_reserved_nodes = queue_reserved_nodes;
+  args->queue_capacity = queue_capacity;
 
   cashier_t* res = xmalloc(sizeof(struct __cashier));
   res->id = id;
@@ -72,34 +86,277 @@ cashier_t* cashier_init(int id, int initial_open_cashiers, int variable_service_
   res->status = status;
   res->status_mutex = status_mutex;
   res->status_closed = status_closed;
-  res->queue_customers_count = queue_customers_count;
+  res->heartbeat = heartbeat;
+  res->service_end = service_end;
+  res->pending_products = pending_products;
+  res->fixed_service_time = args->fixed_service_time;
+  res->variable_service_time = args->variable_service_time;
+  res->owns_queue = shared_line == NULL;
+  res->cashier_class = cashier_class_of(all_cashiers, id);
+  res->priority_aging = all_cashiers->priority_aging;
+  res->service_count = 0;
+  res->service_msecs = 0;
+  res->args = args;
+  res->served_customers = 0;
+  res->elaborated_products = 0;
+  //-1 means that the cashier has never been opened yet
+  res->closures_count = *status == OPEN ? 0 : -1;
+  res->closed_since = *status == OPEN ? 0 : monotonic_msecs();
+  args->cashier = res;
+  args->all_cashiers = all_cashiers;
 
 
   CHECK_PTHREAD_CREATE( pthread_create(&(res->thread), NULL, cashier, args),
-              "cashier", free(res) );
+              "cashier", free(res); return NULL );
 
   return res;
 
 }
 
 
-void cashier_join(cashier_t* cashier){
+cashier_t* cashier_clone(cashier_t* model, int id, unsigned int* seed){
+
+  struct __cashier_args* args = model->args;
+
+  //With id+1 as initial_open_cashiers the cashier starts open
+  return cashier_init(id, id+1, args->variable_service_time, args->log,
+            args->customers_counter, seed, args->supermarket_log, model->queue->kind, args->queue_reserved_nodes, args->queue_capacity,
+            args->all_cashiers);
+
+}
+
+
+int cashier_restart(cashier_t* current_cashier){
+
+  int err = pthread_create(&current_cashier->thread, NULL, cashier, current_cashier->args);
+  if (err){
+    errno = err;
+    perror("pthread_create");
+    current_cashier->thread = 0;
+    return 0;
+  }
+
+  return 1;
+
+}
+
+
+static void cashier_write_record(cashier_t* cashier){
+
+  struct __binlog_record cashier_record;
+  binlog_cashier(&cashier_record, cashier->id, cashier->served_customers,
+            cashier->elaborated_products, cashier->closures_count);
+  xlog_record(cashier->args->supermarket_log, &cashier_record);
+
+}
+
+
+void cashier_retire(cashier_t* cashier){
+
+  XLOCK(cashier->status_mutex);
+  __atomic_store_n(cashier->status, RETIRED, __ATOMIC_RELAXED);
+  XSIGNAL(cashier->status_closed);
+  XUNLOCK(cashier->status_mutex);
 
-  push_fifo(cashier->queue->fifo, NULL, cashier->queue->mutex, cashier->queue->empty);
   CHECK_PTHREAD_JOIN(pthread_join(cashier->thread, NULL),
               "cashier", exit(EXIT_FAILURE));
+  cashier->thread = 0;
+
+}
+
+
+void cashier_send_away(cashier_t* cashier){
+
+  void* elem = NULL;
+
+  while (queue_try_pop(cashier->queue, &elem)){
+
+    struct __customer_at_cashier* customer = elem;
+
+    if (customer){
+      __atomic_sub_fetch(cashier->pending_products, customer->products_count, __ATOMIC_RELAXED);
+      //The customer will choose another queue
+      stats_add(&cashier->args->all_cashiers->stats, cashier->id, STATS_EVICTIONS, 1);
+      stats_add(&cashier->args->all_cashiers->stats, cashier->id, STATS_CHANGED_QUEUES, 1);
+      customer_respond(customer, 0);
+    }
+
+  }
+
+}
+
+
+int cashier_try_enqueue(cashier_t* cashier, struct __customer_at_cashier* customer){
+
+  //The products are added before the push, so that the
+  //  cashier never subtracts them before they are added
+  __atomic_add_fetch(cashier->pending_products, customer->products_count, __ATOMIC_RELAXED);
+
+  //In the priority queue a customer waits behind the ones with less
+  //  products, but every priority_aging milliseconds spent in queue
+  //  are worth one product less, so that nobody waits forever.
+  int pushed = 0;
+  if (cashier->priority_aging > 0){
+    long key = monotonic_msecs() + (long)customer->products_count*cashier->priority_aging;
+    pushed = queue_try_push_node_sorted(cashier->queue, &customer->node, key);
+  } else {
+    pushed = queue_try_push_node(cashier->queue, &customer->node);
+  }
+
+  if (!pushed){
+    __atomic_sub_fetch(cashier->pending_products, customer->products_count, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  return 1;
+
+}
+
+
+int cashier_move_last(cashier_t* from, cashier_t* to){
+
+  //The last customer is the one who would wait the most
+  //  where he is, and his node is unlinked in O(1)
+  void* elem = NULL;
+  if (!queue_steal(from->queue, &elem)) return -1;
+
+  struct __customer_at_cashier* customer = elem;
+  int id = customer->id;
+
+  __atomic_sub_fetch(from->pending_products, customer->products_count, __ATOMIC_RELAXED);
+  __atomic_add_fetch(to->pending_products, customer->products_count, __ATOMIC_RELAXED);
+  customer->changed_queues_count++;
+  stats_add(&from->args->all_cashiers->stats, from->id, STATS_CHANGED_QUEUES, 1);
+
+  //The customer must not be touched after the push: once in
+  //  the queue he can be served and be gone right away
+  if (to->priority_aging > 0){
+    queue_try_push_node_sorted(to->queue, &customer->node, customer->node.key);
+  } else {
+    queue_push_node(to->queue, &customer->node);
+  }
+
+  return id;
+
+}
+
+
+int cashier_class_of(struct __all_cashiers* all_cashiers, int cashier_index){
+
+  if (cashier_index >= all_cashiers->express_first && cashier_index < all_cashiers->express_end){
+    return CASHIER_EXPRESS;
+  }
+
+  return CASHIER_NORMAL;
+
+}
+
+
+int customer_class_of(struct __all_cashiers* all_cashiers, int products_count){
+
+  if (all_cashiers->express_first < all_cashiers->express_end
+          && products_count <= all_cashiers->express_products_limit){
+    return CASHIER_EXPRESS;
+  }
+
+  return CASHIER_NORMAL;
+
+}
+
+
+long cashier_expected_work(cashier_t* cashier){
+
+  long products = __atomic_load_n(cashier->pending_products, __ATOMIC_RELAXED);
+  if (products < 0) products = 0;
+
+  return products * cashier->variable_service_time
+            + queue_count(cashier->queue) * cashier->fixed_service_time;
+
+}
+
+
+void cashier_wake_up(cashier_t* cashier){
+
+  queue_wake_up(cashier->queue);
+
+}
+
+
+//Takes the first customer of the longest open queue of the same class,
+//  if it has at least as many customers as STEAL_MIN_QUEUE: he is the
+//  one who has waited the most. Must be called with the status of the
+//  cashier locked and OPEN, so that it can't be closed meanwhile.
+static struct __customer_at_cashier* cashier_steal(struct __cashier_args* args){
+
+  struct __all_cashiers* all_cashiers = args->all_cashiers;
+  struct __open_cashiers* open_cashiers = &all_cashiers->open_cashiers[args->cashier->cashier_class];
+
+  int victim = -1;
+  int victim_count = STEAL_MIN_QUEUE-1;
+
+  unsigned long version;
+  do {
+    version = open_cashiers_read_begin(open_cashiers);
+    int count = __atomic_load_n(&open_cashiers->count, __ATOMIC_RELAXED);
+    victim = -1;
+    victim_count = STEAL_MIN_QUEUE-1;
+    for (int i = 0; i<count; i++){
+      int index = __atomic_load_n(&open_cashiers->index[i], __ATOMIC_RELAXED);
+      if (index == args->id) continue;
+      int queue_count_value = queue_count((all_cashiers->cashiers_list)[index]->queue);
+      if (queue_count_value > victim_count){
+        victim = index;
+        victim_count = queue_count_value;
+      }
+    }
+  } while (open_cashiers_read_retry(open_cashiers, version));
+
+  if (victim == -1) return NULL;
+
+  cashier_t* victim_cashier = (all_cashiers->cashiers_list)[victim];
+  void* elem = NULL;
+  if (!queue_steal_head(victim_cashier->queue, &elem)) return NULL;
+
+  struct __customer_at_cashier* customer = elem;
+
+  //The customer is now in our queue as far as his products and
+  //  his log are concerned, as if he changed queue by himself
+  __atomic_sub_fetch(victim_cashier->pending_products, customer->products_count, __ATOMIC_RELAXED);
+  __atomic_add_fetch(args->pending_products, customer->products_count, __ATOMIC_RELAXED);
+  customer->changed_queues_count++;
+  stats_add(&all_cashiers->stats, victim, STATS_CHANGED_QUEUES, 1);
+
+  xlog_printf(args->log, "Cashier %d stole customer %d from cashier %d (TID: %ld)\n",
+              args->id, customer->id, victim, pthread_self());
+
+  return customer;
+
+}
+
+
+void cashier_join(cashier_t* cashier){
 
-  free_fifo(cashier->queue->fifo);
-  free(cashier->queue->fifo);
-  free(cashier->queue->mutex);
-  free(cashier->queue->empty);
-  free(cashier->queue);
+  //A retired cashier has no thread, and its record is still to be written
+  if (cashier->thread){
+    CHECK_PTHREAD_JOIN(pthread_join(cashier->thread, NULL),
+                "cashier", exit(EXIT_FAILURE));
+  } else {
+    cashier_write_record(cashier);
+  }
+
+  //The shared line is freed by its owner
+  if (cashier->owns_queue){
+    queue_free(cashier->queue);
+    free(cashier->queue);
+    free(cashier->pending_products);
+  }
 
   free(cashier->status);
   free(cashier->status_mutex);
   free(cashier->status_closed);
-
-  free(cashier->queue_customers_count);
+  free(cashier->heartbeat);
+  free(cashier->service_end);
+  free(cashier->args);
 
   free(cashier);
 
@@ -110,16 +367,23 @@ void cashier_cleanup(void* args_pointer){
 
   struct __cashier_cleanup_args* args = args_pointer;
 
-  XLOCK(args->cashier_args->log->mutex);
-  fprintf(args->cashier_args->log->file, "Cashier thread %d closing... (TID: %ld)\n",
-              args->cashier_args->id, pthread_self());
-  XUNLOCK(args->cashier_args->log->mutex);
+  struct __fifo_stats stats;
+  queue_stats(args->cashier_args->queue, &stats);
 
-  CHECK_PTHREAD_JOIN(pthread_join(*(args->report_to_director_thread), NULL),
-              "report to director", exit(EXIT_FAILURE));
+  if (args->cashier_args->queue->kind == QUEUE_RING){
+    xlog_printf(args->cashier_args->log, "Cashier %d queue: %ld places, %ld customers "
+                "found it full (TID: %ld)\n", args->cashier_args->id, stats.allocated_nodes,
+                stats.full_pushes, pthread_self());
+  } else {
+    xlog_printf(args->cashier_args->log, "Cashier %d queue nodes: %ld allocated, "
+                "%ld reused (TID: %ld)\n", args->cashier_args->id, stats.allocated_nodes,
+                stats.reused_nodes, pthread_self());
+  }
+  xlog_printf(args->cashier_args->log, "Cashier thread %d closing... (TID: %ld)\n",
+              args->cashier_args->id, pthread_self());
 
-  free(args->report_to_director_thread);
-  free(args->cashier_args);
+  //The thread arguments belong to the cashier, which
+  //  may start a new thread with them
   free(args);
 
 }
@@ -129,47 +393,25 @@ void* cashier(void* args_pointer){
 
   struct __cashier_args* args = (struct __cashier_args*)args_pointer;
 
-  XLOCK(args->log->mutex);
-  fprintf(args->log->file, "Cashier thread %d started (TID: %ld)\n",
+  xlog_printf(args->log, "Cashier thread %d started (TID: %ld)\n",
               args->id, pthread_self());
-  XUNLOCK(args->log->mutex);
-
-  // -- SETTING UP REPORT TO DIRECTOR THREAD --
-  struct __report_to_director_args* report_to_director_args = xmalloc(sizeof(struct __report_to_director_args));
-  report_to_director_args->queue_customers_count = args->queue_customers_count;
-  report_to_director_args->frequency = args->report_to_director_frequency;
-  report_to_director_args->queue = args->queue;
-
-  pthread_t* report_to_director_thread = xmalloc(sizeof(pthread_t));
-
-  CHECK_PTHREAD_CREATE( pthread_create(report_to_director_thread, NULL, report_to_director, report_to_director_args),
-              "entrance", exit(EXIT_FAILURE) );
-  // -------------------
 
   // -- SETTING UP CLEANUP FUNCTION --
   struct __cashier_cleanup_args* cleanup_args = xmalloc(sizeof(struct __cashier_cleanup_args));
   cleanup_args->cashier_args = args_pointer;
-  cleanup_args->report_to_director_thread = report_to_director_thread;
   pthread_cleanup_push(cashier_cleanup, cleanup_args);
   // -------------------
 
   // -- LOG VARIABLES --
-  int cashier_served_customers = 0;
-  int cashier_elaborated_products = 0;
-  int cashier_closures_count;
+  //A retired cashier started again goes on from its last totals
+  int cashier_served_customers = args->cashier->served_customers;
+  int cashier_elaborated_products = args->cashier->elaborated_products;
+  int cashier_closures_count = args->cashier->closures_count;
   struct timespec time_cashier_opened;
   struct timespec time_cashier_closed;
   SYS_CALL(clock_gettime(CLOCK_REALTIME, &time_cashier_opened), "clock_gettime");
   // -------------------
 
-  XLOCK(args->status_mutex)
-  if ( *(args->status) == OPEN ){
-    cashier_closures_count = 0;
-  } else {
-    cashier_closures_count = -1;
-  }
-  XUNLOCK(args->status_mutex);
-
   //The cashiers will keep being open even after a signal has been
   //  to serve any remaining customer. 
   XLOCK(args->customers_counter->mutex);
@@ -180,19 +422,38 @@ void* cashier(void* args_pointer){
     while ( *(args->status) == OPEN ){
       XUNLOCK(args->status_mutex);
 
-      struct __customer_at_cashier* customer = pop_fifo(args->queue->fifo,
-                  args->queue->mutex, args->queue->empty);
+      //On the shared line the cashier stops waiting as soon as it is
+      //  closed, since no one is going to push a "wake up" just for him.
+      struct __customer_at_cashier* customer = NULL;
+      int steal_wait = __atomic_load_n(&args->all_cashiers->steal_wait, __ATOMIC_RELAXED);
+      if (!args->cashier->owns_queue){
+        customer = queue_pop_while(args->queue, args->status);
+      } else if (steal_wait > 0){
+        //An idle cashier helps the others instead of waiting
+        void* elem = NULL;
+        while (!queue_pop_timed(args->queue, &elem, steal_wait)){
+          //Once closed, the cashier waits for the "wake up" element
+          //  instead of serving somebody else's customer
+          XLOCK(args->status_mutex);
+          if (*(args->status) == OPEN) elem = cashier_steal(args);
+          XUNLOCK(args->status_mutex);
+          if (elem) break;
+        }
+        customer = elem;
+      } else {
+        customer = queue_pop(args->queue);
+      }
+      __atomic_store_n(args->heartbeat, monotonic_msecs(), __ATOMIC_RELAXED);
 
       //If sigquit status has been received, we don't "serve" him
       //  and we just respond that a sigquit has been received.
-      if (sigquit_status && customer){
+      if (customer){
+        __atomic_sub_fetch(args->pending_products, customer->products_count, __ATOMIC_RELAXED);
+      }
 
-        XLOCK(customer->response_mutex);
-        *(customer->response) = -2;
-        XSIGNAL(customer->no_response);
-        XUNLOCK(customer->response_mutex);
+      if (sigquit_status && customer){
 
-        free(customer);
+        customer_respond(customer, -2);
 
       } else if (customer){
 
@@ -201,31 +462,32 @@ void* cashier(void* args_pointer){
         SYS_CALL(clock_gettime(CLOCK_REALTIME, customer->time_queue_out), "clock_gettime");
         struct timespec time_customer_served_start;
         memcpy(&time_customer_served_start, customer->time_queue_out, sizeof(struct timespec));
+
+        //Same time in queue the customer will write in his record
+        struct timespec time_in_queue;
+        timespec_diff(customer->time_queue_in, customer->time_queue_out, &time_in_queue);
+        histogram_record(&args->all_cashiers->queue_wait[args->cashier->cashier_class],
+                  time_in_queue.tv_sec*THOUSAND + time_in_queue.tv_nsec/MILLION);
         int customer_id = customer->id;
         int customer_products_count = customer->products_count;
 
-        XLOCK(args->log->mutex);
-        fprintf(args->log->file, "Cashier %d is serving customer %d (TID: %ld)\n",
+        xlog_printf(args->log, "Cashier %d is serving customer %d (TID: %ld)\n",
                     args->id, customer->id, pthread_self());
-        XUNLOCK(args->log->mutex);
 
-        nanotimer(args->fixed_service_time +
-                  args->variable_service_time * customer->products_count);
+        int service_time = args->fixed_service_time +
+                  args->variable_service_time * customer->products_count;
+        __atomic_store_n(args->service_end, monotonic_msecs() + service_time, __ATOMIC_RELAXED);
 
-        //Write response to customer and signal him.
-        XLOCK(customer->response_mutex);
-        *(customer->response) = 1;
-        XSIGNAL(customer->no_response);
-        XUNLOCK(customer->response_mutex);
+        nanotimer(service_time);
 
-        XLOCK(args->supermarket_log->mutex);
-        //+=1 beacuse compiler would warn with ++
-        //  ("value computed is not used [-Wunused-value]")
-        *(args->served_customers_count)+=1;
-        *(args->bought_products_count)+=customer->products_count;
-        XUNLOCK(args->supermarket_log->mutex);
+        //Write response to customer and signal him.
+        //After this the customer struct can't be used anymore,
+        //  since it lives on the stack of the customer thread.
+        customer_respond(customer, 1);
+        __atomic_store_n(args->heartbeat, monotonic_msecs(), __ATOMIC_RELAXED);
 
-        free(customer);
+        stats_add(&args->all_cashiers->stats, args->id, STATS_SERVED_CUSTOMERS, 1);
+        stats_add(&args->all_cashiers->stats, args->id, STATS_BOUGHT_PRODUCTS, customer_products_count);
 
         //Compute time to serve customer for log file.
         struct timespec time_customer_served_end;
@@ -233,14 +495,20 @@ void* cashier(void* args_pointer){
         struct timespec time_to_serve;
         timespec_diff(&time_customer_served_start, &time_customer_served_end, &time_to_serve);
 
-        XLOCK(args->supermarket_log->mutex);
-        fprintf(args->supermarket_log->file,  "KC\t%d\t%d\t%ld.%03lu\n",
-                  args->id, customer_id, time_to_serve.tv_sec, time_to_serve.tv_nsec/MILLION);
-        XUNLOCK(args->supermarket_log->mutex);
+        struct __binlog_record served_record;
+        binlog_served(&served_record, args->id, customer_id, timespec_nsecs(&time_to_serve));
+        xlog_record(args->supermarket_log, &served_record);
 
         cashier_served_customers++;
         cashier_elaborated_products+=customer_products_count;
 
+        latency_histogram_record(&args->all_cashiers->service_time[args->id],
+                  time_to_serve.tv_sec*MILLION + time_to_serve.tv_nsec/THOUSAND);
+
+        __atomic_add_fetch(&args->cashier->service_msecs,
+                  time_to_serve.tv_sec*THOUSAND + time_to_serve.tv_nsec/MILLION, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&args->cashier->service_count, 1, __ATOMIC_RELAXED);
+
       }
 
       //This code will take care of the remaining clients
@@ -257,8 +525,15 @@ void* cashier(void* args_pointer){
 
       XLOCK(args->status_mutex)
     }
+    int closed = *(args->status) != OPEN;
     XUNLOCK(args->status_mutex);
 
+    //Only the cashier can pop from a QUEUE_MPSC, so here
+    //  the cashiers handler can't empty the queue for us.
+    if (closed && args->queue->kind == QUEUE_MPSC){
+      cashier_send_away(args->cashier);
+    }
+
     if (sighup_status || sigquit_status){
       XLOCK(args->customers_counter->mutex);
       break;
@@ -273,15 +548,13 @@ void* cashier(void* args_pointer){
       struct timespec time_workshift;
       timespec_diff(&time_cashier_opened, &time_cashier_closed, &time_workshift);
 
-      XLOCK(args->supermarket_log->mutex);
-      fprintf(args->supermarket_log->file, "KS\t%d\t%ld.%03lu\n",
-                args->id, time_workshift.tv_sec, time_workshift.tv_nsec/MILLION);
-      XUNLOCK(args->supermarket_log->mutex);
+      struct __binlog_record workshift_record;
+      binlog_workshift(&workshift_record, args->id, timespec_nsecs(&time_workshift));
+      xlog_record(args->supermarket_log, &workshift_record);
 
-      XLOCK(args->log->mutex);
-      fprintf(args->log->file, "Cashier %d closed by director (TID: %ld)\n",
+      xlog_printf(args->log, "Cashier %d closed by director (TID: %ld)\n",
                 args->id, pthread_self());
-      XUNLOCK(args->log->mutex);
+      stats_add(&args->all_cashiers->stats, args->id, STATS_CLOSURES, 1);
     }
 
     cashier_closures_count++;
@@ -291,13 +564,20 @@ void* cashier(void* args_pointer){
     while ( *(args->status) == CLOSE && !sighup_status && !sigquit_status){
       XWAIT(args->status_closed, args->status_mutex);
     }
+    int retired = *(args->status) == RETIRED;
     XUNLOCK(args->status_mutex);
 
+    //The thread is not needed until the cashier is opened again
+    if (retired){
+      xlog_printf(args->log, "Cashier %d retired by director (TID: %ld)\n",
+                args->id, pthread_self());
+      XLOCK(args->customers_counter->mutex);
+      break;
+    }
+
     if (cashier_closures_count != 0 && !sighup_status && !sigquit_status){
-      XLOCK(args->log->mutex);
-      fprintf(args->log->file, "Cashier %d reopened by director (TID: %ld)\n",
+      xlog_printf(args->log, "Cashier %d reopened by director (TID: %ld)\n",
                 args->id, pthread_self());
-      XUNLOCK(args->log->mutex);
     }
 
     //Register the time the cashier reopened to compute the workshift time
@@ -313,18 +593,22 @@ void* cashier(void* args_pointer){
     struct timespec time_workshift;
     timespec_diff(&time_cashier_opened, &time_cashier_closed, &time_workshift);
 
-    XLOCK(args->supermarket_log->mutex);
-    fprintf(args->supermarket_log->file, "KS\t%d\t%ld.%03lu\n",
-              args->id, time_workshift.tv_sec, time_workshift.tv_nsec/MILLION);
-    XUNLOCK(args->supermarket_log->mutex);
+    struct __binlog_record workshift_record;
+    binlog_workshift(&workshift_record, args->id, timespec_nsecs(&time_workshift));
+    xlog_record(args->supermarket_log, &workshift_record);
 
   }
 
+  args->cashier->served_customers = cashier_served_customers;
+  args->cashier->elaborated_products = cashier_elaborated_products;
+  args->cashier->closures_count = cashier_closures_count;
+
   //Log general informations about the cashier as requested by specific.
-  XLOCK(args->supermarket_log->mutex);
-  fprintf(args->supermarket_log->file, "K\t%d\t%d\t%d\t%d\n",
-            args->id, cashier_served_customers, cashier_elaborated_products, cashier_closures_count);
-  XUNLOCK(args->supermarket_log->mutex);
+  //A retired thread only leaves its totals in the cashier: the record
+  //  is written once, by the last thread or by cashier_join().
+  if (__atomic_load_n(args->status, __ATOMIC_RELAXED) != RETIRED){
+    cashier_write_record(args->cashier);
+  }
 
   pthread_cleanup_pop(1);
 
@@ -333,32 +617,162 @@ void* cashier(void* args_pointer){
 }
 
 
-void* report_to_director(void* args_pointer){
+void latency_report(struct __all_cashiers* all_cashiers, struct __xlog* log, const char* title){
+
+  latency_histogram_print_header(log, title);
+  latency_histogram_print(&all_cashiers->supermarket_time, log, "time in supermarket");
+  latency_histogram_print(&all_cashiers->queue_time, log, "time in queue");
+  latency_histogram_print(&all_cashiers->permission_wait, log, "permission wait");
 
-  struct __report_to_director_args* args = (struct __report_to_director_args*)args_pointer;
+  //Only the cashiers that served somebody
+  int count = __atomic_load_n(&all_cashiers->count, __ATOMIC_ACQUIRE);
+  for (int i = 0; i<count; i++){
+    if (__atomic_load_n(&all_cashiers->service_time[i].count, __ATOMIC_RELAXED) == 0) continue;
+    char name[32];
+    snprintf(name, sizeof(name), "service, cashier %d", i);
+    latency_histogram_print(&all_cashiers->service_time[i], log, name);
+  }
 
-  while(!sighup_status && !sigquit_status){
+}
 
-    int count = get_count_fifo(args->queue->fifo, args->queue->mutex);
 
-    //The following memory is shared with the cashiers handler thread.
-    //The old value is overwritten. The update frequency is taken from
-    //  the config file.
-    XLOCK(&args->queue_customers_count->mutex);
-    args->queue_customers_count->count = count;
-    XSIGNAL(&args->queue_customers_count->old_value);
-    XUNLOCK(&args->queue_customers_count->mutex);
+void open_cashiers_init(struct __open_cashiers* open_cashiers, int cashiers_count){
 
-    nanotimer(args->frequency);
+  open_cashiers->version = 0;
+  open_cashiers->count = 0;
+  open_cashiers->index = xmalloc(sizeof(int)*cashiers_count);
+  open_cashiers->position = xmalloc(sizeof(int)*cashiers_count);
 
+  for (int i = 0; i<cashiers_count; i++){
+    open_cashiers->position[i] = -1;
   }
 
-  XLOCK(&args->queue_customers_count->mutex);
-  XSIGNAL(&args->queue_customers_count->old_value);
-  XUNLOCK(&args->queue_customers_count->mutex);
+  CHECK_ERR(pthread_mutex_init(&open_cashiers->mutex, NULL), "mutex init");
+  CHECK_ERR(pthread_cond_init(&open_cashiers->not_empty, NULL), "cond init");
 
-  free(args);
+}
 
-  return NULL;
+
+void open_cashiers_free(struct __open_cashiers* open_cashiers){
+
+  free(open_cashiers->index);
+  free(open_cashiers->position);
+  pthread_mutex_destroy(&open_cashiers->mutex);
+  pthread_cond_destroy(&open_cashiers->not_empty);
+
+}
+
+
+//The version is made odd before changing the set and even again after,
+//  the fences keep the changes between the two stores.
+static void open_cashiers_write_begin(struct __open_cashiers* open_cashiers){
+
+  __atomic_store_n(&open_cashiers->version, open_cashiers->version+1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+}
+
+
+static void open_cashiers_write_end(struct __open_cashiers* open_cashiers){
+
+  __atomic_store_n(&open_cashiers->version, open_cashiers->version+1, __ATOMIC_RELEASE);
+
+}
+
+
+void open_cashiers_add(struct __open_cashiers* open_cashiers, int cashier_index){
+
+  if (open_cashiers->position[cashier_index] != -1) return;
+
+  open_cashiers_write_begin(open_cashiers);
+
+  int count = open_cashiers->count;
+  __atomic_store_n(&open_cashiers->index[count], cashier_index, __ATOMIC_RELAXED);
+  __atomic_store_n(&open_cashiers->count, count+1, __ATOMIC_RELAXED);
+  open_cashiers->position[cashier_index] = count;
+
+  open_cashiers_write_end(open_cashiers);
+
+  //The count is already written, so a reader checking it under
+  //  the mutex either sees it or is waiting for this broadcast
+  if (count == 0){
+    XLOCK(&open_cashiers->mutex);
+    CHECK_ERR(pthread_cond_broadcast(&open_cashiers->not_empty), "cond broadcast");
+    XUNLOCK(&open_cashiers->mutex);
+  }
+
+}
+
+
+void open_cashiers_remove(struct __open_cashiers* open_cashiers, int cashier_index){
+
+  int position = open_cashiers->position[cashier_index];
+  if (position == -1) return;
+
+  open_cashiers_write_begin(open_cashiers);
+
+  //The last open cashier takes the place of the removed one
+  int last = open_cashiers->index[open_cashiers->count-1];
+  __atomic_store_n(&open_cashiers->index[position], last, __ATOMIC_RELAXED);
+  __atomic_store_n(&open_cashiers->count, open_cashiers->count-1, __ATOMIC_RELAXED);
+  open_cashiers->position[last] = position;
+  open_cashiers->position[cashier_index] = -1;
+
+  open_cashiers_write_end(open_cashiers);
+
+}
+
+
+unsigned long open_cashiers_read_begin(struct __open_cashiers* open_cashiers){
+
+  unsigned long version;
+
+  //Odd: the handler is changing the set right now
+  while ((version = __atomic_load_n(&open_cashiers->version, __ATOMIC_ACQUIRE)) % 2){
+    sched_yield();
+  }
+
+  return version;
+
+}
+
+
+int open_cashiers_read_retry(struct __open_cashiers* open_cashiers, unsigned long version){
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+  return __atomic_load_n(&open_cashiers->version, __ATOMIC_RELAXED) != version;
+
+}
+
+
+int open_cashiers_pick(struct __open_cashiers* open_cashiers, unsigned int* seed){
+
+  int random = rand_r(seed);
+
+  while (1){
+
+    unsigned long version = open_cashiers_read_begin(open_cashiers);
+
+    int count = __atomic_load_n(&open_cashiers->count, __ATOMIC_RELAXED);
+    int res = count > 0 ? __atomic_load_n(&open_cashiers->index[random % count], __ATOMIC_RELAXED) : -1;
+
+    if (!open_cashiers_read_retry(open_cashiers, version)){
+      if (res != -1) return res;
+      open_cashiers_wait(open_cashiers);
+    }
+
+  }
+
+}
+
+
+void open_cashiers_wait(struct __open_cashiers* open_cashiers){
+
+  XLOCK(&open_cashiers->mutex);
+  while (__atomic_load_n(&open_cashiers->count, __ATOMIC_RELAXED) == 0){
+    XWAIT(&open_cashiers->not_empty, &open_cashiers->mutex);
+  }
+  XUNLOCK(&open_cashiers->mutex);
 
 }
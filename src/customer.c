@@ -8,6 +8,8 @@
 
 #include <cashier.h>
 #include <customer.h>
+#include <customer_engine.h>
+#include <customer_pool.h>
 #include <supermarket.h>
 #include <utils.h>
 
@@ -15,13 +17,20 @@
 customer_t* customer_init(int id, struct __all_cashiers* all_cashiers,
            struct __customers_counter* customers_counter, queue_t* director_permissions_list,
            struct __xlog* log, int max_fixed_time_to_shop, int max_fixed_products_count,
-           unsigned int* supermarket_seed, struct __xlog* supermarket_log){
+           unsigned int* supermarket_seed, struct __xlog* supermarket_log,
+           struct __customer_engine* engine, struct __customer_pool* pool){
 
   struct __customer_args* args = xmalloc(sizeof(struct __customer_args));
   args->id = id;
   args->time_to_shop = MIN_FIXED_TIME_TO_SHOP + ( rand_r(supermarket_seed)
                     % (max_fixed_time_to_shop-MIN_FIXED_TIME_TO_SHOP) );
   args->products_count = rand_r(supermarket_seed) % max_fixed_products_count;
+
+  //Read by the predictive scheduler as the arrival rate of each class
+  if (args->products_count > 0){
+    __atomic_add_fetch(&all_cashiers->arrivals[customer_class_of(all_cashiers, args->products_count)],
+              1, __ATOMIC_RELAXED);
+  }
   args->all_cashiers = all_cashiers;
   args->customers_counter = customers_counter;
   args->director_permissions_list = director_permissions_list;
@@ -32,6 +41,18 @@ customer_t* customer_init(int id, struct __all_cashiers* all_cashiers,
   res->id = id;
   res->thread = 0;
 
+  //The counter is increased before the customer starts, since
+  //  a worker of the engine or of the pool may run it (and let
+  //  it out) right away
+  if (engine || pool){
+    XLOCK(customers_counter->mutex);
+    (*(customers_counter->count))++;
+    XUNLOCK(customers_counter->mutex);
+    if (engine) customer_engine_add(engine, args);
+    else customer_pool_submit(pool, args);
+    return res;
+  }
+
   CHECK_PTHREAD_CREATE( pthread_create(&(res->thread), NULL, customer, args),
               "customer", free(res); return res );
 
@@ -51,10 +72,137 @@ void customer_cleanup(void* args_pointer){
   struct __customers_counter* cc = args->customers_counter;
   free(args);
 
-  XLOCK(cc->mutex);
-  (*(cc->count))--;
-  XSIGNAL(cc->full);
-  XUNLOCK(cc->mutex);
+  customer_leave(cc);
+
+}
+
+
+void customer_leave(struct __customers_counter* customers_counter){
+
+  XLOCK(customers_counter->mutex);
+  (*(customers_counter->count))--;
+  XSIGNAL(customers_counter->full);
+  XUNLOCK(customers_counter->mutex);
+
+}
+
+
+void customer_respond(struct __customer_at_cashier* customer, int response){
+
+  //Customers run by the engine have no thread waiting
+  if (customer->on_response){
+    *(customer->response) = response;
+    customer->on_response(customer);
+    return;
+  }
+
+  XLOCK(customer->response_mutex);
+  *(customer->response) = response;
+  XSIGNAL(customer->no_response);
+  XUNLOCK(customer->response_mutex);
+
+}
+
+
+//Open cashier with the least expected work. The whole set is
+//  read, so the scan is restarted if the set changes meanwhile.
+static int shortest_work_cashier(struct __all_cashiers* all_cashiers,
+            struct __open_cashiers* open_cashiers){
+
+  while(1){
+
+    unsigned long version = open_cashiers_read_begin(open_cashiers);
+
+    int count = __atomic_load_n(&open_cashiers->count, __ATOMIC_RELAXED);
+    int best = -1;
+    long best_work = 0;
+
+    for (int i = 0; i<count; i++){
+      int index = __atomic_load_n(&open_cashiers->index[i], __ATOMIC_RELAXED);
+      long work = cashier_expected_work((all_cashiers->cashiers_list)[index]);
+      if (best == -1 || work < best_work){
+        best = index;
+        best_work = work;
+      }
+    }
+
+    if (!open_cashiers_read_retry(open_cashiers, version)){
+      if (best != -1) return best;
+      //Every cashier of the class is closed: no point in reading again
+      //  before the cashiers handler opens one
+      open_cashiers_wait(open_cashiers);
+    }
+
+  }
+
+}
+
+
+cashier_t* customer_choose_cashier(struct __all_cashiers* all_cashiers, int products_count,
+            unsigned int* seed, int* index){
+
+  //Only the cashiers of the class of the customer are considered
+  struct __open_cashiers* open_cashiers =
+              &all_cashiers->open_cashiers[customer_class_of(all_cashiers, products_count)];
+
+  //Choosing a cashier among the open ones, as set by the policy. The set
+  //  of the open cashiers is read without locking, so the choosen cashier
+  //  could have been closed in the meantime: only then we choose again.
+  while(1){
+
+    switch (all_cashiers->selection_policy){
+
+      //The shorter queue between two random ones
+      case SELECT_TWO_CHOICES: {
+        int first = open_cashiers_pick(open_cashiers, seed);
+        int second = open_cashiers_pick(open_cashiers, seed);
+        *index = queue_count((all_cashiers->cashiers_list)[second]->queue)
+                    < queue_count((all_cashiers->cashiers_list)[first]->queue) ? second : first;
+        break;
+      }
+
+      case SELECT_SHORTEST_WORK:
+        *index = shortest_work_cashier(all_cashiers, open_cashiers);
+        break;
+
+      default:
+        *index = open_cashiers_pick(open_cashiers, seed);
+        break;
+
+    }
+
+    cashier_t* current_cashier = (all_cashiers->cashiers_list)[*index];
+
+    XLOCK(current_cashier->status_mutex);
+    if (*(current_cashier->status) == OPEN){
+      return current_cashier;
+    }
+    XUNLOCK(current_cashier->status_mutex);
+
+  }
+
+}
+
+
+void customer_write_record(struct __xlog* supermarket_log, int id, struct timespec* time_in_supermarket,
+           struct timespec* time_in_queue, int changed_queues_count, int products_count){
+
+  struct __binlog_record record;
+  binlog_customer(&record, id, changed_queues_count, products_count,
+            timespec_nsecs(time_in_supermarket), timespec_nsecs(time_in_queue));
+  xlog_record(supermarket_log, &record);
+
+}
+
+
+#define USECS(time) ((time)->tv_sec*MILLION + (time)->tv_nsec/THOUSAND)
+
+void customer_record_latency(struct __all_cashiers* all_cashiers, struct timespec* time_in_supermarket,
+           struct timespec* time_in_queue, struct timespec* permission_wait){
+
+  latency_histogram_record(&all_cashiers->supermarket_time, USECS(time_in_supermarket));
+  if (time_in_queue) latency_histogram_record(&all_cashiers->queue_time, USECS(time_in_queue));
+  if (permission_wait) latency_histogram_record(&all_cashiers->permission_wait, USECS(permission_wait));
 
 }
 
@@ -65,12 +213,19 @@ void* customer(void* args_pointer){
   //  terminate asynchronously to the supermarket.
   pthread_detach(pthread_self());
 
+  customer_run(args_pointer);
+
+  return NULL;
+
+}
+
+
+void customer_run(void* args_pointer){
+
   struct __customer_args* args = (struct __customer_args*)args_pointer;
 
-  XLOCK(args->log->mutex);
-  fprintf(args->log->file, "Customer thread %d started (TID: %ld)\n",
+  xlog_printf(args->log, "Customer thread %d started (TID: %ld)\n",
               args->id, pthread_self());
-  XUNLOCK(args->log->mutex);
 
   //As specific, we need to keep track of the time the
   //  customer spends inside the supermarket and log it.
@@ -97,16 +252,16 @@ void* customer(void* args_pointer){
 
     if (!sigquit_status){
 
-      XLOCK(args->log->mutex);
-      fprintf(args->log->file, "Customer %d has 0 products and is asking the "
+      xlog_printf(args->log, "Customer %d has 0 products and is asking the "
         "director for permission to exit (TID: %ld)\n", args->id, pthread_self());
-      XUNLOCK(args->log->mutex);
 
-      struct __permission_request* new_request = xmalloc(sizeof(struct __permission_request));
-      new_request->status = &permission_status;
-      new_request->mutex = &permission_mutex;
-      new_request->no_permission = &no_permission;
-      new_request->time_permission_received = &time_queue_out;
+      struct __permission_request new_request;
+      fifo_node_init(&new_request.node, &new_request);
+      new_request.status = &permission_status;
+      new_request.mutex = &permission_mutex;
+      new_request.no_permission = &no_permission;
+      new_request.time_permission_received = &time_queue_out;
+      new_request.on_permission = NULL;
 
       //As specific, we need to keep track of the time the
       //  customer spends inside the queue(s) and log it.
@@ -117,8 +272,7 @@ void* customer(void* args_pointer){
       SYS_CALL(clock_gettime(CLOCK_REALTIME, &time_queue_in), "clock_gettime");
 
       //Sending the permission request to the director.
-      push_fifo(args->director_permissions_list->fifo, new_request,
-        args->director_permissions_list->mutex, args->director_permissions_list->empty);
+      queue_push_node(args->director_permissions_list, &new_request.node);
 
       XLOCK(&permission_mutex);
       while(!permission_status){
@@ -129,10 +283,8 @@ void* customer(void* args_pointer){
       //**
       SYS_CALL(clock_gettime(CLOCK_REALTIME, &time_queue_out), "clock_gettime");
 
-      XLOCK(args->log->mutex);
-      fprintf(args->log->file, "Customer  %d has received permission from "
+      xlog_printf(args->log, "Customer  %d has received permission from "
                   "director to exit (TID: %ld)\n", args->id, pthread_self());
-      XUNLOCK(args->log->mutex);
 
     }
 
@@ -152,23 +304,16 @@ void* customer(void* args_pointer){
     }
 
     //Writing logs requested by specific
-    XLOCK(args->supermarket_log->mutex);
-    fprintf(args->supermarket_log->file, "C\t%d", args->id);
-    fprintf(args->supermarket_log->file, "\t%ld.%03lu",
-              time_in_supermarket.tv_sec, time_in_supermarket.tv_nsec/MILLION);
-    fprintf(args->supermarket_log->file, "\t%ld.%03lu",
-              time_in_queue.tv_sec, time_in_queue.tv_nsec/MILLION);
     //0 queues changed, 0 products bought
-    fprintf(args->supermarket_log->file, "\t0\t0\n");
-    XUNLOCK(args->supermarket_log->mutex);
+    customer_write_record(args->supermarket_log, args->id, &time_in_supermarket, &time_in_queue, 0, 0);
+    customer_record_latency(args->all_cashiers, &time_in_supermarket, NULL,
+              permission_status ? &time_in_queue : NULL);
 
-    XLOCK(args->log->mutex);
-    fprintf(args->log->file, "Customer %d exiting the supermarket... (TID: %ld)\n",
+    xlog_printf(args->log, "Customer %d exiting the supermarket... (TID: %ld)\n",
               args->id, pthread_self());
-    XUNLOCK(args->log->mutex);
 
     pthread_cleanup_pop(1);
-    return NULL;
+    return;
 
   }
 
@@ -181,7 +326,7 @@ void* customer(void* args_pointer){
 
   unsigned int seed = time(NULL);
 
-  int changed_queues_count = 0;
+  int full_queues_count = 0;
   struct timespec time_queue_in;
   struct timespec time_queue_out;
 
@@ -193,64 +338,58 @@ void* customer(void* args_pointer){
   pthread_mutex_t response_mutex = PTHREAD_MUTEX_INITIALIZER;
   pthread_cond_t no_response = PTHREAD_COND_INITIALIZER;
 
+  //The following struct will be sent to the cashier.
+  //Data will be used for computation, signal back the
+  //  result, and logging.
+  //It can be reused every time we change queue, since
+  //  it has already been popped when we get a response.
+  struct __customer_at_cashier new_customer;
+  new_customer.id = args->id;
+  new_customer.products_count = args->products_count;
+  new_customer.changed_queues_count = 0;
+  new_customer.response = &response;
+  new_customer.response_mutex = &response_mutex;
+  new_customer.no_response = &no_response;
+  new_customer.time_queue_in = &time_queue_in;
+  new_customer.time_queue_out = &time_queue_out;
+  new_customer.on_response = NULL;
+
   while (response != 1  && !sigquit_status) {
 
-    //The following struct will be sent to the cashier.
-    //Data will be used for computation, signal back the
-    //  result, and logging.
     response = -1;
-    struct __customer_at_cashier* new_customer = xmalloc(sizeof(struct __customer_at_cashier));
-    new_customer->id = args->id;
-    new_customer->products_count = args->products_count;
-    new_customer->response = &response;
-    new_customer->response_mutex = &response_mutex;
-    new_customer->no_response = &no_response;
-    new_customer->time_queue_out = &time_queue_out;
-
-    //Choosing a random cashier.
-    //This algorithm is highly inefficient, specially in the case where
-    //  there are only few cashiers open and a lot closed.
-    //A better solution (in particular if we want to scale up the program) would
-    //  be to map in an array only the opened cashiers and than choose a random index.
-    //Another version of the algorithm would be to choose a random starting index,
-    //  and then increment it until we find an open cashier. This algorithm is way
-    //  faster but has a very high probability to create very long queues inside a
-    //  single cashier.
-    int index = rand_r(&seed) % args->all_cashiers->count;
-    cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[0];
-
-    int found = 0;
-    while(!found){
-
-      current_cashier = (args->all_cashiers->cashiers_list)[index];
-
-      XLOCK(current_cashier->status_mutex);
-      if (*(current_cashier->status) == OPEN){
-        found = 1;
-      } else {
-        XUNLOCK(current_cashier->status_mutex);
-        index = rand_r(&seed) % args->all_cashiers->count;
-      }
+    fifo_node_init(&new_customer.node, &new_customer);
 
-    }
+    //The cashier is returned with its status mutex locked, so
+    //  that it can't be closed before we are in its queue.
+    int index = 0;
+    cashier_t* current_cashier = customer_choose_cashier(args->all_cashiers, args->products_count, &seed, &index);
 
-    XLOCK(args->log->mutex);
-    fprintf(args->log->file, "Customer %d going to pay at cash %d (TID: %ld)\n",
+    xlog_printf(args->log, "Customer %d going to pay at cash %d (TID: %ld)\n",
                 args->id, index, pthread_self());
-    XUNLOCK(args->log->mutex);
-
-    queue_t* current_queue = current_cashier->queue;
 
     //As specific, we need to keep track of the time the customer spends inside the
     //  queue(s) and log it. We only memorize the time the first time we enter a queue.
     //This clock_gettime() will be paired with the one inside the cashier
     //  that will serve this customer. If the customer is not served, 0 will be printed.
-    if (changed_queues_count == 0){
+    if (new_customer.changed_queues_count == 0 && full_queues_count == 0){
       SYS_CALL(clock_gettime(CLOCK_REALTIME, &time_queue_in), "clock_gettime");
     }
 
     //Sending the data to the choosen queue to be served.
-    push_fifo(current_queue->fifo, new_customer, current_queue->mutex, current_queue->empty);
+    //A bounded queue may be full: in that case we don't wait
+    //  holding the cashier status, but we choose again.
+    if (!cashier_try_enqueue(current_cashier, &new_customer)){
+
+      XUNLOCK(current_cashier->status_mutex);
+      full_queues_count++;
+
+      xlog_printf(args->log, "Customer %d found the queue of cash %d full (TID: %ld)\n",
+                  args->id, index, pthread_self());
+
+      nanotimer(1);
+      continue;
+
+    }
 
     XUNLOCK(current_cashier->status_mutex);
 
@@ -263,11 +402,9 @@ void* customer(void* args_pointer){
     XUNLOCK(&response_mutex);
 
     if (response == 0){
-      changed_queues_count++;
-      XLOCK(args->log->mutex);
-      fprintf(args->log->file, "Customer %d has changed queue... (TID: %ld)\n",
+      new_customer.changed_queues_count++;
+      xlog_printf(args->log, "Customer %d has changed queue... (TID: %ld)\n",
                   args->id, pthread_self());
-      XUNLOCK(args->log->mutex);
     }
 
   }
@@ -290,25 +427,18 @@ void* customer(void* args_pointer){
   }
 
   //Writing logs requested by specific.
-  XLOCK(args->supermarket_log->mutex);
-  fprintf(args->supermarket_log->file, "C\t%d", args->id);
-  fprintf(args->supermarket_log->file, "\t%ld.%03lu",
-            time_in_supermarket.tv_sec, time_in_supermarket.tv_nsec/MILLION);
-  fprintf(args->supermarket_log->file, "\t%ld.%03lu",
-            time_in_queue.tv_sec, time_in_queue.tv_nsec/MILLION);
-  fprintf(args->supermarket_log->file, "\t%d", changed_queues_count);
-  fprintf(args->supermarket_log->file, "\t%d\n", customer_bought_products_count);
-  XUNLOCK(args->supermarket_log->mutex);
-
-  XLOCK(args->log->mutex);
+  customer_write_record(args->supermarket_log, args->id, &time_in_supermarket, &time_in_queue,
+            new_customer.changed_queues_count, customer_bought_products_count);
+  customer_record_latency(args->all_cashiers, &time_in_supermarket,
+            response == 1 ? &time_in_queue : NULL, NULL);
+
   if (response == 1){
-    fprintf(args->log->file, "Customer %d exiting the "
+    xlog_printf(args->log, "Customer %d exiting the "
               "supermarket... (TID: %ld)\n", args->id, pthread_self());
   } else {
-    fprintf(args->log->file, "Customer %d exiting the supermarket "
+    xlog_printf(args->log, "Customer %d exiting the supermarket "
               "because of sigquit signal... (TID: %ld)\n", args->id, pthread_self());
   }
-  XUNLOCK(args->log->mutex);
 
   pthread_cleanup_pop(1);
 
@@ -317,11 +447,8 @@ void* customer(void* args_pointer){
   //  every customer got out
   XLOCK(customers_counter_copy->mutex);
   if (!sigquit_status || (sigquit_status && *customers_counter_copy->count > 0) ){
-    push_fifo(temp_director_permissions_list->fifo, NULL,
-      temp_director_permissions_list->mutex, temp_director_permissions_list->empty);
+    queue_wake_up(temp_director_permissions_list);
   }
   XUNLOCK(customers_counter_copy->mutex);
 
-  return NULL;
-
 }
@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <cashier.h>
+#include <customer.h>
+#include <customer_engine.h>
+#include <supermarket.h>
+#include <utils.h>
+
+
+static void* engine_worker(void* args_pointer);
+
+
+customer_engine_t* customer_engine_init(int workers_count, int reserved_nodes, timer_wheel_t* wheel){
+
+  customer_engine_t* engine = xmalloc(sizeof(customer_engine_t));
+
+  queue_init(&engine->ready, QUEUE_LIST, reserved_nodes, 0);
+  engine->wheel = wheel;
+
+  engine->workers_count = workers_count;
+  engine->workers = xmalloc(sizeof(pthread_t)*workers_count);
+  for (int i = 0; i<workers_count; i++){
+    CHECK_PTHREAD_CREATE( pthread_create(&engine->workers[i], NULL, engine_worker, engine),
+              "engine worker", exit(EXIT_FAILURE) );
+  }
+
+  return engine;
+
+}
+
+
+void customer_engine_join(customer_engine_t* engine){
+
+  //One "wake up" element for each worker
+  for (int i = 0; i<engine->workers_count; i++){
+    queue_wake_up(&engine->ready);
+  }
+
+  for (int i = 0; i<engine->workers_count; i++){
+    CHECK_PTHREAD_JOIN(pthread_join(engine->workers[i], NULL),
+                "engine worker", exit(EXIT_FAILURE));
+  }
+
+  queue_free(&engine->ready);
+
+  free(engine->workers);
+  free(engine);
+
+}
+
+
+static void make_ready(customer_engine_t* engine, struct __engine_customer* customer){
+
+  fifo_node_init(&customer->run_node, customer);
+  queue_push_node(&engine->ready, &customer->run_node);
+
+}
+
+
+static void on_timer(void* arg){
+
+  struct __engine_customer* customer = arg;
+  make_ready(customer->engine, customer);
+
+}
+
+
+//The customer will be made ready again after the given milliseconds.
+static void schedule(customer_engine_t* engine, struct __engine_customer* customer, int msecs){
+
+  timer_wheel_add(engine->wheel, &customer->timer, msecs, on_timer, customer);
+
+}
+
+
+//Called by the cashier (or by the director, if the cashier
+//  has been closed) in place of waking up a customer thread
+static void on_response(struct __customer_at_cashier* at_cashier){
+
+  struct __engine_customer* customer = (struct __engine_customer*)
+              ((char*)at_cashier - offsetof(struct __engine_customer, at_cashier));
+  make_ready(customer->engine, customer);
+
+}
+
+
+//Called by the director in place of waking up a customer thread
+static void on_permission(struct __permission_request* request){
+
+  struct __engine_customer* customer = (struct __engine_customer*)
+              ((char*)request - offsetof(struct __engine_customer, permission));
+  make_ready(customer->engine, customer);
+
+}
+
+
+void customer_engine_add(customer_engine_t* engine, struct __customer_args* args){
+
+  struct __engine_customer* customer = xmalloc(sizeof(struct __engine_customer));
+  customer->args = args;
+  customer->engine = engine;
+  customer->state = ENGINE_SHOPPING;
+  customer->seed = time(NULL) ^ args->id;
+  customer->response = -1;
+  customer->permission_status = 0;
+  customer->full_queues_count = 0;
+
+  struct __customer_at_cashier* at_cashier = &customer->at_cashier;
+  at_cashier->id = args->id;
+  at_cashier->products_count = args->products_count;
+  at_cashier->changed_queues_count = 0;
+  at_cashier->response = &customer->response;
+  at_cashier->response_mutex = NULL;
+  at_cashier->no_response = NULL;
+  at_cashier->time_queue_in = &customer->time_queue_in;
+  at_cashier->time_queue_out = &customer->time_queue_out;
+  at_cashier->on_response = on_response;
+
+  struct __permission_request* permission = &customer->permission;
+  permission->status = &customer->permission_status;
+  permission->mutex = NULL;
+  permission->no_permission = NULL;
+  permission->time_permission_received = &customer->time_queue_out;
+  permission->on_permission = on_permission;
+
+  xlog_printf(args->log, "Customer %d started (TID: %ld)\n",
+              args->id, pthread_self());
+
+  SYS_CALL(clock_gettime(CLOCK_REALTIME, &customer->time_entered), "clock_gettime");
+
+  schedule(engine, customer, args->time_to_shop);
+
+}
+
+
+//Same as the end of a customer thread
+static void customer_exit(struct __engine_customer* customer){
+
+  struct __customer_args* args = customer->args;
+
+  struct timespec time_exited;
+  SYS_CALL(clock_gettime(CLOCK_REALTIME, &time_exited), "clock_gettime");
+
+  struct timespec time_in_supermarket;
+  timespec_diff(&customer->time_entered, &time_exited, &time_in_supermarket);
+
+  struct timespec time_in_queue = {0,0};
+  int bought_products_count = 0;
+
+  if (args->products_count == 0){
+    if (customer->permission_status){
+      timespec_diff(&customer->time_queue_in, &customer->time_queue_out, &time_in_queue);
+    }
+  } else if (customer->response == 1){
+    timespec_diff(&customer->time_queue_in, &customer->time_queue_out, &time_in_queue);
+    bought_products_count = args->products_count;
+  }
+
+  customer_write_record(args->supermarket_log, args->id, &time_in_supermarket, &time_in_queue,
+            customer->at_cashier.changed_queues_count, bought_products_count);
+  customer_record_latency(args->all_cashiers, &time_in_supermarket,
+            args->products_count > 0 && customer->response == 1 ? &time_in_queue : NULL,
+            args->products_count == 0 && customer->permission_status ? &time_in_queue : NULL);
+
+  if (args->products_count == 0 || customer->response == 1){
+    xlog_printf(args->log, "Customer %d exiting the "
+              "supermarket... (TID: %ld)\n", args->id, pthread_self());
+  } else {
+    xlog_printf(args->log, "Customer %d exiting the supermarket "
+              "because of sigquit signal... (TID: %ld)\n", args->id, pthread_self());
+  }
+
+  struct __customers_counter* customers_counter = args->customers_counter;
+  queue_t* director_permissions_list = args->director_permissions_list;
+  int products_count = args->products_count;
+  free(args);
+  free(customer);
+
+  customer_leave(customers_counter);
+
+  //Even if we have more than 0 products, we still signal
+  //  the director so he doesn't get stuck waiting when
+  //  every customer got out
+  if (products_count > 0){
+    XLOCK(customers_counter->mutex);
+    if (!sigquit_status || (sigquit_status && *customers_counter->count > 0) ){
+      queue_wake_up(director_permissions_list);
+    }
+    XUNLOCK(customers_counter->mutex);
+  }
+
+}
+
+
+//Runs the customer until it has to wait for someone else.
+//After the customer has been pushed in a queue it may already be
+//  run by another worker, so it must not be touched anymore.
+static void run_customer(struct __engine_customer* customer){
+
+  struct __customer_args* args = customer->args;
+
+  while (1){
+
+    switch (customer->state){
+
+      case ENGINE_SHOPPING:
+
+        if (args->products_count > 0){
+          customer->state = ENGINE_CHECKOUT;
+          break;
+        }
+
+        if (sigquit_status){
+          customer_exit(customer);
+          return;
+        }
+
+        xlog_printf(args->log, "Customer %d has 0 products and is asking the "
+          "director for permission to exit (TID: %ld)\n", args->id, pthread_self());
+
+        SYS_CALL(clock_gettime(CLOCK_REALTIME, &customer->time_queue_in), "clock_gettime");
+
+        customer->state = ENGINE_AT_DIRECTOR;
+        fifo_node_init(&customer->permission.node, &customer->permission);
+        queue_push_node(args->director_permissions_list, &customer->permission.node);
+        return;
+
+      case ENGINE_CHECKOUT: {
+
+        if (sigquit_status){
+          customer_exit(customer);
+          return;
+        }
+
+        int index = 0;
+        cashier_t* current_cashier = customer_choose_cashier(args->all_cashiers, args->products_count,
+                    &customer->seed, &index);
+
+        xlog_printf(args->log, "Customer %d going to pay at cash %d (TID: %ld)\n",
+                    args->id, index, pthread_self());
+
+        if (customer->at_cashier.changed_queues_count == 0 && customer->full_queues_count == 0){
+          SYS_CALL(clock_gettime(CLOCK_REALTIME, &customer->time_queue_in), "clock_gettime");
+        }
+
+        customer->response = -1;
+        customer->state = ENGINE_AT_CASHIER;
+        fifo_node_init(&customer->at_cashier.node, &customer->at_cashier);
+
+        if (!cashier_try_enqueue(current_cashier, &customer->at_cashier)){
+
+          XUNLOCK(current_cashier->status_mutex);
+          customer->full_queues_count++;
+          customer->state = ENGINE_CHECKOUT;
+
+          xlog_printf(args->log, "Customer %d found the queue of cash %d full (TID: %ld)\n",
+                      args->id, index, pthread_self());
+
+          schedule(customer->engine, customer, 1);
+          return;
+
+        }
+
+        XUNLOCK(current_cashier->status_mutex);
+        return;
+
+      }
+
+      case ENGINE_AT_CASHIER:
+
+        if (customer->response != 0){
+          customer_exit(customer);
+          return;
+        }
+
+        customer->at_cashier.changed_queues_count++;
+        xlog_printf(args->log, "Customer %d has changed queue... (TID: %ld)\n",
+                    args->id, pthread_self());
+
+        customer->state = ENGINE_CHECKOUT;
+        break;
+
+      case ENGINE_AT_DIRECTOR:
+
+        SYS_CALL(clock_gettime(CLOCK_REALTIME, &customer->time_queue_out), "clock_gettime");
+
+        xlog_printf(args->log, "Customer  %d has received permission from "
+                    "director to exit (TID: %ld)\n", args->id, pthread_self());
+
+        customer_exit(customer);
+        return;
+
+    }
+
+  }
+
+}
+
+
+static void* engine_worker(void* args_pointer){
+
+  customer_engine_t* engine = (customer_engine_t*)args_pointer;
+
+  struct __engine_customer* customer = NULL;
+
+  //NULL is only pushed by customer_engine_join()
+  while ( (customer = queue_pop(&engine->ready)) ){
+    run_customer(customer);
+  }
+
+  return NULL;
+
+}
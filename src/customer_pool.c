@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <errno.h>
+#include <pthread.h>
+
+#include <customer.h>
+#include <customer_pool.h>
+#include <utils.h>
+
+
+static void* pool_worker(void* args_pointer);
+
+
+//Must be called with the pool mutex locked.
+static void add_worker(customer_pool_t* pool){
+
+  if (pool->workers_count == pool->workers_capacity){
+    pool->workers_capacity *= 2;
+    pool->workers = realloc(pool->workers, sizeof(pthread_t)*pool->workers_capacity);
+    CHECK_PTR(pool->workers, "realloc", exit(EXIT_FAILURE));
+  }
+
+  CHECK_PTHREAD_CREATE( pthread_create(&pool->workers[pool->workers_count], NULL, pool_worker, pool),
+            "customer pool worker", exit(EXIT_FAILURE) );
+  pool->workers_count++;
+
+}
+
+
+customer_pool_t* customer_pool_init(int workers_count, int reserved_nodes){
+
+  customer_pool_t* pool = xmalloc(sizeof(customer_pool_t));
+
+  queue_init(&pool->jobs, QUEUE_LIST, reserved_nodes, 0);
+  CHECK_ERR(pthread_mutex_init(&pool->mutex, NULL), "mutex init");
+
+  pool->workers_count = 0;
+  pool->workers_capacity = workers_count > 0 ? workers_count : 1;
+  pool->workers = xmalloc(sizeof(pthread_t)*pool->workers_capacity);
+  pool->prespawned_count = workers_count;
+  pool->submitted = 0;
+
+  //Every new worker waits for a customer nobody has promised him yet
+  XLOCK(&pool->mutex);
+  pool->idle = workers_count;
+  for (int i = 0; i<workers_count; i++){
+    add_worker(pool);
+  }
+  XUNLOCK(&pool->mutex);
+
+  return pool;
+
+}
+
+
+void customer_pool_submit(customer_pool_t* pool, struct __customer_args* args){
+
+  //Each customer is promised to an idle worker, so that he never
+  //  waits in the queue for a customer that is still shopping.
+  //A worker created for him may also pop another customer, but
+  //  then the worker he was promised to will pop him.
+  XLOCK(&pool->mutex);
+  if (pool->idle > 0){
+    pool->idle--;
+  } else {
+    add_worker(pool);
+  }
+  pool->submitted++;
+  XUNLOCK(&pool->mutex);
+
+  queue_push(&pool->jobs, args);
+
+}
+
+
+void customer_pool_join(customer_pool_t* pool, struct __xlog* log){
+
+  XLOCK(&pool->mutex);
+  int workers_count = pool->workers_count;
+  XUNLOCK(&pool->mutex);
+
+  //One "wake up" element for each worker
+  for (int i = 0; i<workers_count; i++){
+    queue_wake_up(&pool->jobs);
+  }
+
+  for (int i = 0; i<workers_count; i++){
+    CHECK_PTHREAD_JOIN(pthread_join(pool->workers[i], NULL),
+                "customer pool worker", exit(EXIT_FAILURE));
+  }
+
+  xlog_printf(log, "Customer pool: %ld customers run by %d threads (%d created on demand)\n",
+            pool->submitted, workers_count, workers_count - pool->prespawned_count);
+
+  queue_free(&pool->jobs);
+  CHECK_ERR(pthread_mutex_destroy(&pool->mutex), "mutex destroy");
+
+  free(pool->workers);
+  free(pool);
+
+}
+
+
+static void* pool_worker(void* args_pointer){
+
+  customer_pool_t* pool = (customer_pool_t*)args_pointer;
+
+  struct __customer_args* args = NULL;
+
+  //NULL is only pushed by customer_pool_join()
+  while ( (args = queue_pop(&pool->jobs)) ){
+
+    customer_run(args);
+
+    //The thread is given back to the pool instead of exiting
+    XLOCK(&pool->mutex);
+    pool->idle++;
+    XUNLOCK(&pool->mutex);
+
+  }
+
+  return NULL;
+
+}
@@ -11,11 +11,13 @@
 #include <customer.h>
 #include <utils.h>
 #include <fifo_unbounded.h>
+#include <histogram.h>
+#include <stats.h>
 
 
 director_t* director_init(struct __all_cashiers* all_cashiers, queue_t* director_permissions_list,
                 struct __customers_counter* customers_counter, pthread_t* entrance_thread,
-                FILE* log, struct __cashiers_handler_args* cashiers_handler_args){
+                struct __xlog* log, struct __cashiers_handler_args* cashiers_handler_args){
 
   struct __director_args* args = xmalloc(sizeof(struct __director_args));
   args->all_cashiers = all_cashiers;
@@ -46,6 +48,27 @@ void director_join(director_t* director){
 }
 
 
+static void give_permission(struct __director_args* args, struct __permission_request* req){
+
+  stats_add_director(&args->all_cashiers->stats, STATS_PERMISSIONS, 1);
+
+  SYS_CALL(clock_gettime(CLOCK_REALTIME, req->time_permission_received), "clock_gettime");
+
+  //Customers run by the engine have no thread waiting
+  if (req->on_permission){
+    *(req->status) = 1;
+    req->on_permission(req);
+    return;
+  }
+
+  XLOCK(req->mutex);
+  *(req->status) = 1;
+  XSIGNAL(req->no_permission);
+  XUNLOCK(req->mutex);
+
+}
+
+
 void* director(void* args_pointer){
 
   struct __director_args* args = (struct __director_args*)args_pointer;
@@ -59,18 +82,30 @@ void* director(void* args_pointer){
   //  we wait until every customer is out.
   while( !sigquit_status && (!sighup_status || *(args->customers_counter->count) > 0) ){
 
-    struct __permission_request* req = pop_fifo(args->director_permissions_list->fifo,
-      args->director_permissions_list->mutex, args->director_permissions_list->empty);
+    queue_t* list = args->director_permissions_list;
+    void* req = NULL;
+
+    //Every pending request is taken with a single lock, and
+    //  answered after the lock has been released.
+    if (list->kind == QUEUE_LIST){
+
+      fifo_chain_t requests;
+      drain_fifo(list->fifo, &requests, list->mutex, list->empty);
+
+      while (pop_chain(&requests, &req)){
+        if (req) give_permission(args, req);
+      }
+
+      release_chain_fifo(list->fifo, &requests, list->mutex);
 
-    if (req){
+    } else {
 
-      SYS_CALL(clock_gettime(CLOCK_REALTIME, req->time_permission_received), "clock_gettime");
+      req = queue_pop(list);
+      if (req) give_permission(args, req);
 
-      XLOCK(req->mutex);
-      *(req->status) = 1;
-      XSIGNAL(req->no_permission);
-      XUNLOCK(req->mutex);
-      free(req);
+      while (queue_try_pop(list, &req)){
+        if (req) give_permission(args, req);
+      }
 
     }
 
@@ -97,11 +132,18 @@ void* director(void* args_pointer){
 
   CHECK_PTHREAD_JOIN(pthread_join(cashiers_handler_thread, NULL),
                 "cashier handler",  exit(EXIT_FAILURE));
-  
-  free_fifo(args->director_permissions_list->fifo);
-  free(args->director_permissions_list->fifo);
-  free(args->director_permissions_list->mutex);
-  free(args->director_permissions_list->empty);
+
+  struct __fifo_stats stats;
+  queue_stats(args->director_permissions_list, &stats);
+  if (args->director_permissions_list->kind == QUEUE_RING){
+    xlog_printf(args->log, "Director permissions list: %ld places, %ld requests found it full\n",
+              stats.allocated_nodes, stats.full_pushes);
+  } else {
+    xlog_printf(args->log, "Director permissions list nodes: %ld allocated, %ld reused\n",
+              stats.allocated_nodes, stats.reused_nodes);
+  }
+
+  queue_free(args->director_permissions_list);
 
   free(args);
 
@@ -110,154 +152,748 @@ void* director(void* args_pointer){
 }
 
 
+//Moves the customers detached from the queue of a closed cashier to the
+//  tail of the shortest open queues, keeping their order. The customers
+//  are not woken up, and every destination queue is locked only once.
+static void migrate_customers(struct __director_args* args, int* cashiers_map,
+                              int closed_index, fifo_chain_t* customers){
+
+  int cashiers_count = args->all_cashiers->count;
+  int* load = xmalloc(sizeof(int)*cashiers_count);
+  fifo_chain_t* moved = xmalloc(sizeof(fifo_chain_t)*cashiers_count);
+
+  //Customers only move to the open cashiers of the same class
+  int closed_class = cashier_class_of(args->all_cashiers, closed_index);
+
+  for (int i = 0; i<cashiers_count; i++){
+    queue_t* queue = (args->all_cashiers->cashiers_list)[i]->queue;
+    fifo_chain_init(&moved[i]);
+    load[i] = cashiers_map[i] == OPEN && cashier_class_of(args->all_cashiers, i) == closed_class
+                ? queue_count(queue) : -1;
+  }
+
+  void* elem = NULL;
+  while (pop_chain(customers, &elem)){
+
+    //Skipping "wake up" elements
+    if (!elem) continue;
+
+    struct __customer_at_cashier* customer = elem;
+
+    int dest = -1;
+    for (int i = 0; i<cashiers_count; i++){
+      if (load[i] != -1 && (dest == -1 || load[i] < load[dest])) dest = i;
+    }
+
+    customer->changed_queues_count++;
+    push_chain(&moved[dest], &customer->node);
+    stats_add(&args->all_cashiers->stats, closed_index, STATS_EVICTIONS, 1);
+    stats_add(&args->all_cashiers->stats, closed_index, STATS_CHANGED_QUEUES, 1);
+
+    //The expected work moves with the customer
+    cashier_t** cashiers_list = args->all_cashiers->cashiers_list;
+    __atomic_sub_fetch(cashiers_list[closed_index]->pending_products,
+              customer->products_count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(cashiers_list[dest]->pending_products,
+              customer->products_count, __ATOMIC_RELAXED);
+    load[dest]++;
+
+    xlog_printf(args->log, "Customer %d moved from cashier %d to cashier %d\n",
+              customer->id, closed_index, dest);
+
+  }
+
+  //A priority queue keeps the keys given when the customers
+  //  first entered the closed queue, so they don't lose their turn
+  for (int i = 0; i<cashiers_count; i++){
+    queue_t* queue = (args->all_cashiers->cashiers_list)[i]->queue;
+    if (args->all_cashiers->priority_aging > 0){
+      merge_chain_fifo(queue->fifo, &moved[i], queue->mutex, queue->empty);
+    } else {
+      splice_fifo(queue->fifo, &moved[i], queue->mutex, queue->empty);
+    }
+  }
+
+  free(load);
+  free(moved);
+
+}
+
+
+//Opens a closed cashier and adds it to the open set of its class.
+//  A retired cashier gets a new thread.
+//Returns 0 if the thread couldn't be started.
+static int open_cashier(struct __director_args* args, int* cashiers_map, int index){
+
+  cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[index];
+
+  XLOCK(current_cashier->status_mutex);
+  int retired = *(current_cashier->status) == RETIRED;
+  __atomic_store_n(current_cashier->status, OPEN, __ATOMIC_RELAXED);
+  XSIGNAL(current_cashier->status_closed);
+  XUNLOCK(current_cashier->status_mutex);
+  current_cashier->closed_since = 0;
+
+  if (retired){
+    if (!cashier_restart(current_cashier)){
+      __atomic_store_n(current_cashier->status, RETIRED, __ATOMIC_RELAXED);
+      return 0;
+    }
+    //Otherwise its queue would look stuck until the first customer
+    __atomic_store_n(current_cashier->heartbeat, monotonic_msecs(), __ATOMIC_RELAXED);
+    xlog_printf(args->log, "Cashier %d restarted\n", index);
+  }
+
+  cashiers_map[index] = OPEN;
+  open_cashiers_add(&args->all_cashiers->open_cashiers[current_cashier->cashier_class], index);
+
+  return 1;
+
+}
+
+
+//Creates a new open cashier at the end of the table, if it has room.
+//The cashier is published before being added to the open set, so
+//  nobody can look for it in the table before it's there.
+static int add_cashier(struct __director_args* args, int* cashiers_map, unsigned int* seed){
+
+  struct __all_cashiers* all_cashiers = args->all_cashiers;
+  int index = all_cashiers->count;
+  if (index >= all_cashiers->max_count) return 0;
+
+  cashier_t* current_cashier = cashier_clone(all_cashiers->cashiers_list[0], index, seed);
+  if (!current_cashier) return 0;
+
+  all_cashiers->cashiers_list[index] = current_cashier;
+  __atomic_store_n(&all_cashiers->count, index+1, __ATOMIC_RELEASE);
+
+  cashiers_map[index] = OPEN;
+  open_cashiers_add(&all_cashiers->open_cashiers[current_cashier->cashier_class], index);
+
+  xlog_printf(args->log, "Cashier %d added\n", index);
+
+  return 1;
+
+}
+
+
+//Closes an open cashier and moves away the customers in its queue.
+static void close_cashier(struct __director_args* args, int* cashiers_map, int index){
+
+  cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[index];
+
+  //Written atomically since a cashier on the shared
+  //  line reads it without the status mutex
+  XLOCK(current_cashier->status_mutex);
+  __atomic_store_n(current_cashier->status, CLOSE, __ATOMIC_RELAXED);
+  XUNLOCK(current_cashier->status_mutex);
+  current_cashier->closed_since = monotonic_msecs();
+  cashiers_map[index] = CLOSE;
+  open_cashiers_remove(&args->all_cashiers->open_cashiers[current_cashier->cashier_class], index);
+
+  queue_t* current_queue = current_cashier->queue;
+
+  //On the shared line closing a desk only means that the cashier
+  //  stops consuming: the customers stay where they are.
+  //A QUEUE_MPSC can only be emptied by its cashier,
+  //  which will do it as soon as it wakes up.
+  if (args->all_cashiers->shared_line){
+
+    queue_wake_all(current_queue);
+
+  } else if (current_queue->kind != QUEUE_LIST){
+
+    if (current_queue->kind == QUEUE_RING){
+      cashier_send_away(current_cashier);
+    }
+    queue_wake_up(current_queue);
+
+  } else {
+
+    //Emptying the queue: the whole list is detached with one
+    //  lock, and customers are moved after releasing it.
+    XLOCK(current_queue->mutex);
+
+    //No need to pass mutex as param since we
+    //  already manually locked it outside
+    fifo_chain_t customers;
+    drain_fifo(current_queue->fifo, &customers, NULL, NULL);
+
+    //"wake up" element in case cashier is stuck waiting
+    push_fifo(current_queue->fifo, NULL, NULL, current_queue->empty);
+
+    XUNLOCK(current_queue->mutex);
+
+    migrate_customers(args, cashiers_map, index, &customers);
+
+    release_chain_fifo(current_queue->fifo, &customers, current_queue->mutex);
+
+  }
+
+}
+
+
+//Random cashier of the given class whose status in the map is status.
+//  There must be at least one.
+static int random_cashier(struct __director_args* args, int* cashiers_map,
+            int cashier_class, int status, unsigned int* seed){
+
+  int count = args->all_cashiers->count;
+
+  int index = rand_r(seed) % count;
+  while(cashiers_map[index] != status || cashier_class_of(args->all_cashiers, index) != cashier_class){
+    index++;
+    index %= count;
+  }
+
+  return index;
+
+}
+
+
+//Opens a closed cashier of the class or, if they are all open, adds a
+//  new one to the table. Returns 0 if no cashier could be opened.
+static int open_one(struct __director_args* args, int* cashiers_map, int cashier_class,
+            int* currently_open, int* class_size, unsigned int* seed){
+
+  if (currently_open[cashier_class] < class_size[cashier_class]){
+    int index = random_cashier(args, cashiers_map, cashier_class, CLOSE, seed);
+    if (!open_cashier(args, cashiers_map, index)) return 0;
+  } else {
+    //New cashiers are never express ones
+    if (cashier_class != CASHIER_NORMAL || !add_cashier(args, cashiers_map, seed)) return 0;
+    class_size[cashier_class]++;
+  }
+
+  currently_open[cashier_class]++;
+  return 1;
+
+}
+
+
+//Jockeying: the last customer of the open queue with the most expected
+//  work moves to the queue with the least, if he would wait at least
+//  jockey_margin milliseconds less. Done here instead of by each waiting
+//  customer, so nobody has to wake up to look at the other queues.
+//At most one move for each cashier of the class, to keep the round short.
+static long rebalance_queues(struct __director_args* args, int* cashiers_map, int cashier_class){
+
+  int count = args->all_cashiers->count;
+  cashier_t** cashiers_list = args->all_cashiers->cashiers_list;
+  long moves = 0;
+
+  for (int m = 0; m<count; m++){
+
+    int longest = -1;
+    int shortest = -1;
+    long longest_wait = 0;
+    long shortest_work = 0;
+
+    for (int i = 0; i<count; i++){
+
+      if (cashiers_map[i] != OPEN || cashier_class_of(args->all_cashiers, i) != cashier_class) continue;
+
+      long work = cashier_expected_work(cashiers_list[i]);
+      int customers = queue_count(cashiers_list[i]->queue);
+
+      //The last customer doesn't wait for himself, his own
+      //  work is guessed as the average of the queue
+      long last_wait = customers > 0 ? work - work/customers : 0;
+
+      if (customers > 0 && (longest == -1 || last_wait > longest_wait)){
+        longest = i;
+        longest_wait = last_wait;
+      }
+      if (shortest == -1 || work < shortest_work){
+        shortest = i;
+        shortest_work = work;
+      }
+
+    }
+
+    if (longest == -1 || longest == shortest
+          || longest_wait - shortest_work <= args->cashiers_handler_args->jockey_margin){
+      break;
+    }
+
+    int id = cashier_move_last(cashiers_list[longest], cashiers_list[shortest]);
+    if (id == -1) break;
+
+    xlog_printf(args->log, "Customer %d jockeyed from cashier %d to cashier %d\n",
+              id, longest, shortest);
+    moves++;
+
+  }
+
+  return moves;
+
+}
+
+
+//Estimates kept by the predictive scheduler for a class of cashiers
+struct __predictive_class{
+  //Counters read in the last round
+  long arrivals;
+  long service_count;
+  long service_msecs;
+  //Customers per millisecond and milliseconds per customer
+  double arrival_rate;
+  double service_time;
+  //Rounds in a row with too many desks open, and the
+  //  most desks needed during those rounds
+  int close_rounds;
+  int close_to;
+};
+
+
+//State of the SLO scheduler for a class of cashiers
+struct __slo_class{
+  rolling_histogram_t queue_wait;
+  //Rounds left before the window shows the effects of the last change
+  int cooldown;
+  //Rounds in a row with the percentile well below the SLO
+  int headroom_rounds;
+  long percentile;
+  long breaches;
+};
+
+
+//Sum of the service counters of the cashiers of a class
+static void read_service(struct __director_args* args, int cashier_class, long* count, long* msecs){
+
+  *count = 0;
+  *msecs = 0;
+  for (int i = 0; i<args->all_cashiers->count; i++){
+    if (cashier_class_of(args->all_cashiers, i) != cashier_class) continue;
+    cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[i];
+    *count += __atomic_load_n(&current_cashier->service_count, __ATOMIC_RELAXED);
+    *msecs += __atomic_load_n(&current_cashier->service_msecs, __ATOMIC_RELAXED);
+  }
+
+}
+
+
+//Expected wait in queue of an M/M/c queue with the given servers and
+//  offered load (arrival rate times service time), from the Erlang C
+//  formula. -1 if the servers can't keep up with the load.
+static double erlang_c_wait(int servers, double load, double service_time){
+
+  if (servers <= load) return -1;
+
+  //Erlang B, computed one server at a time to avoid factorials
+  double blocking = 1;
+  for (int k = 1; k<=servers; k++){
+    blocking = load*blocking / (k + load*blocking);
+  }
+
+  double waiting_probability = servers*blocking / (servers - load*(1-blocking));
+
+  return waiting_probability*service_time / (servers - load);
+
+}
+
+
+//Updates the estimates of a class with the last round, and returns
+//  how many desks of the class should be open. Desks are opened as
+//  soon as they are needed, but closed only after the estimate has
+//  asked for less of them for PREDICTIVE_CLOSE_ROUNDS rounds in a row.
+static int predictive_desks(struct __director_args* args, struct __predictive_class* estimate,
+            int cashier_class, int open, int size, int queued, int period){
+
+  long arrivals = __atomic_load_n(&args->all_cashiers->arrivals[cashier_class], __ATOMIC_RELAXED);
+  double arrival_sample = (double)(arrivals - estimate->arrivals) / period;
+  estimate->arrival_rate += PREDICTIVE_EWMA_WEIGHT*(arrival_sample - estimate->arrival_rate);
+  estimate->arrivals = arrivals;
+
+  long service_count = 0;
+  long service_msecs = 0;
+  read_service(args, cashier_class, &service_count, &service_msecs);
+  if (service_count > estimate->service_count){
+    double service_sample = (double)(service_msecs - estimate->service_msecs)
+                              / (service_count - estimate->service_count);
+    if (estimate->service_time == 0) estimate->service_time = service_sample;
+    else estimate->service_time += PREDICTIVE_EWMA_WEIGHT*(service_sample - estimate->service_time);
+  }
+  estimate->service_count = service_count;
+  estimate->service_msecs = service_msecs;
+
+  //Nobody has been served yet, nothing to base a decision on
+  if (estimate->service_time <= 0) return open;
+
+  int target_wait = args->cashiers_handler_args->target_wait;
+
+  double load = estimate->arrival_rate*estimate->service_time;
+  int needed = size;
+  for (int servers = 1; servers<=size; servers++){
+    double wait = erlang_c_wait(servers, load, estimate->service_time);
+    if (wait >= 0 && wait <= target_wait){
+      needed = servers;
+      break;
+    }
+  }
+
+  //The formula only looks at the steady state: the customers already
+  //  in queue must also be served within the target wait
+  int backlog = (int)(queued*estimate->service_time / target_wait) + (queued > 0);
+  if (backlog > needed) needed = backlog;
+  if (needed > size) needed = size;
+  if (needed < 1) needed = 1;
+
+  if (needed >= open){
+    estimate->close_rounds = 0;
+    return needed;
+  }
+
+  if (estimate->close_rounds == 0 || needed > estimate->close_to) estimate->close_to = needed;
+  if (++estimate->close_rounds < PREDICTIVE_CLOSE_ROUNDS) return open;
+
+  estimate->close_rounds = 0;
+  return estimate->close_to;
+
+}
+
+
+//Returns how many desks of the class should be open so that the
+//  percentile of the queue wait in the last SLO_WINDOW_ROUNDS rounds
+//  stays under target_wait. When the SLO is broken desks are opened in
+//  proportion to how much; one desk is closed after SLO_CLOSE_ROUNDS
+//  rounds in a row with the percentile under SLO_HEADROOM_PERCENT of
+//  the SLO. After a change the window needs some rounds to catch up.
+static int slo_desks(struct __director_args* args, struct __slo_class* slo,
+            int cashier_class, int open, int size, int queued){
+
+  rolling_histogram_update(&slo->queue_wait, &args->all_cashiers->queue_wait[cashier_class]);
+
+  int target_wait = args->cashiers_handler_args->target_wait;
+  slo->percentile = rolling_histogram_percentile(&slo->queue_wait,
+                          args->cashiers_handler_args->slo_percentile);
+
+  //Too few customers have been served to trust the percentile
+  int enough = slo->queue_wait.window_count >= SLO_MIN_SAMPLES;
+  int breached = enough && slo->percentile > target_wait;
+  if (breached) slo->breaches++;
+
+  if (slo->cooldown > 0){
+    slo->cooldown--;
+    return open;
+  }
+
+  if (breached){
+    slo->headroom_rounds = 0;
+    int needed = (open*slo->percentile + target_wait-1) / target_wait;
+    if (needed <= open) needed = open+1;
+    if (needed > size) needed = size;
+    if (needed != open) slo->cooldown = SLO_COOLDOWN_ROUNDS;
+    return needed;
+  }
+
+  //With nobody served nor waiting, there is no need for many desks
+  int headroom = enough ? slo->percentile*100 <= (long)target_wait*SLO_HEADROOM_PERCENT
+                        : queued == 0;
+  if (!headroom){
+    slo->headroom_rounds = 0;
+    return open;
+  }
+
+  if (++slo->headroom_rounds < SLO_CLOSE_ROUNDS || open <= 1) return open;
+
+  slo->headroom_rounds = 0;
+  slo->cooldown = SLO_COOLDOWN_ROUNDS;
+  return open-1;
+
+}
+
+
 void* cashiers_handler(void* args_pointer){
 
   struct __director_args* args = (struct __director_args*)args_pointer;
 
   unsigned int seed = time(NULL);
 
-  int currently_open = args->cashiers_handler_args->initial_open_cashiers;
-
   //The cashiers_map will be used to keep track of which cashier are
-  //  open at a certain time.
-  int* cashiers_map = xmalloc(sizeof(int)*args->all_cashiers->count);
+  //  open at a certain time. Each class of cashiers is handled on
+  //  its own, as if it were a different supermarket.
+  //The map has room for the cashiers that may be added later.
+  int* cashiers_map = xmalloc(sizeof(int)*args->all_cashiers->max_count);
+  int currently_open[CASHIER_CLASSES] = {0};
+  int class_size[CASHIER_CLASSES] = {0};
   for (int i = 0; i<args->all_cashiers->count; i++){
-    if (i < args->cashiers_handler_args->initial_open_cashiers){
-      cashiers_map[i] = OPEN;
-    } else {
-      cashiers_map[i] = CLOSE;
+    cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[i];
+    cashiers_map[i] = __atomic_load_n(current_cashier->status, __ATOMIC_RELAXED);
+    if (cashiers_map[i] == OPEN) currently_open[current_cashier->cashier_class]++;
+    class_size[current_cashier->cashier_class]++;
+  }
+
+  struct __predictive_class predictive[CASHIER_CLASSES];
+  memset(predictive, 0, sizeof(predictive));
+  for (int c = 0; c<CASHIER_CLASSES; c++){
+    predictive[c].arrivals = __atomic_load_n(&args->all_cashiers->arrivals[c], __ATOMIC_RELAXED);
+    read_service(args, c, &predictive[c].service_count, &predictive[c].service_msecs);
+  }
+
+  struct __slo_class slo[CASHIER_CLASSES];
+  memset(slo, 0, sizeof(slo));
+  if (args->cashiers_handler_args->scheduler == SCHEDULER_SLO){
+    for (int c = 0; c<CASHIER_CLASSES; c++){
+      rolling_histogram_init(&slo[c].queue_wait, &args->all_cashiers->queue_wait[c], SLO_WINDOW_ROUNDS);
     }
   }
 
-  while(!sighup_status && !sigquit_status){
+  long desks_opened[CASHIER_CLASSES] = {0};
+  long desks_closed[CASHIER_CLASSES] = {0};
 
-    if (DEBUG>=2) printf("-->>Currently open: %d\n"
-                         "----------------------\n", currently_open);
+  int initial_count = args->all_cashiers->count;
+  long retired_cashiers = 0;
 
-    int above_max = 0;
-    int below_min = 0;
+  //The queues are sampled every F milliseconds. Each round sleeps until
+  //  an absolute deadline, so that the time spent deciding doesn't
+  //  shift the period, and never waits for a cashier.
+  int period = args->cashiers_handler_args->report_to_director_frequency;
+  struct timespec deadline;
+  SYS_CALL(clock_gettime(CLOCK_MONOTONIC, &deadline), "clock_gettime");
 
-    for (int i = 0; i<args->all_cashiers->count; i++){
+  //Statistics on the decision rounds, written in the director log
+  long rounds = 0;
+  long missed_periods = 0;
+  long stale_readings = 0;
+  long jockeyed_customers = 0;
+  long total_latency = 0;
+  long max_latency = 0;
 
-      struct __cashier_director_comm* curr_queue = (args->all_cashiers->cashiers_list)[i]->queue_customers_count;
+  //The counters are read live, without stopping anybody
+  long last_stats_report = monotonic_msecs();
+  long last_latency_snapshot = last_stats_report;
+  int latency_snapshot = args->cashiers_handler_args->latency_snapshot;
 
-      //for each cashier, reads the number of customers in queue from
-      //  shared memory with cashiers. The value is always up
-      //  to date because the cashier overwrites the old one.
-      XLOCK(&curr_queue->mutex);
-      while (curr_queue->count == -1 && !sighup_status && !sigquit_status){
-        XWAIT(&curr_queue->old_value, &curr_queue->mutex);
-      }
-      int buffer = curr_queue->count;
-      curr_queue->count = -1;
-      XUNLOCK(&curr_queue->mutex);
+  while(!sighup_status && !sigquit_status){
 
+    if (DEBUG>=2) printf("-->>Currently open: %d + %d express\n"
+                         "----------------------\n",
+                         currently_open[CASHIER_NORMAL], currently_open[CASHIER_EXPRESS]);
+
+    int above_max[CASHIER_CLASSES] = {0};
+    int below_min[CASHIER_CLASSES] = {0};
+    int queued[CASHIER_CLASSES] = {0};
+
+    timespec_add_msecs(&deadline, period);
+    int err = 0;
+    while ((err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)) == EINTR){
       if (sighup_status || sigquit_status) break;
+    }
+    if (err && err != EINTR){
+      errno = err;
+      perror("clock_nanosleep");
+    }
+
+    if (sighup_status || sigquit_status) break;
+
+    //If the last round took longer than a period, the periods
+    //  missed are skipped instead of being run back to back
+    struct timespec round_start;
+    SYS_CALL(clock_gettime(CLOCK_MONOTONIC, &round_start), "clock_gettime");
+    struct timespec late;
+    timespec_diff(&deadline, &round_start, &late);
+    long late_periods = (late.tv_sec*THOUSAND + late.tv_nsec/MILLION) / period;
+    if (late.tv_sec >= 0 && late_periods > 0){
+      missed_periods += late_periods;
+      timespec_add_msecs(&deadline, late_periods*period);
+    }
+
+    long now = monotonic_msecs();
+
+    if (now - last_stats_report >= STATS_REPORT_MSECS){
+      stats_print(&args->all_cashiers->stats, args->log, "Stats");
+      last_stats_report = now;
+    }
+
+    if (latency_snapshot > 0 && now - last_latency_snapshot >= latency_snapshot){
+      latency_report(args->all_cashiers, args->log, "Latencies so far");
+      last_latency_snapshot = now;
+    }
 
-      //If current cashier is close, skip
+    //On the shared line every open cashier has the same share of
+    //  customers. There are no express cashiers on the shared line.
+    int shared_buffer = 0;
+    if (args->all_cashiers->shared_line && currently_open[CASHIER_NORMAL] > 0){
+      shared_buffer = queue_count(&args->all_cashiers->shared_line->queue)
+                        / currently_open[CASHIER_NORMAL];
+    }
+
+    for (int i = 0; i<args->all_cashiers->count; i++){
+
+      cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[i];
+      int cashier_class = current_cashier->cashier_class;
+
+      //for each cashier, reads the number of customers in queue.
+      //The depth is published by the queue itself, so no
+      //  lock is needed to read it.
+      int buffer = queue_count(current_cashier->queue);
+      if (args->all_cashiers->shared_line) buffer = shared_buffer;
+
+      //A cashier with customers in queue which hasn't shown to be alive
+      //  for a while is stuck: its queue is not going to get shorter.
+      //While serving, the time is counted from the expected end of the
+      //  service, however long the basket is.
+      long last_seen = __atomic_load_n(current_cashier->heartbeat, __ATOMIC_RELAXED);
+      long service_end = __atomic_load_n(current_cashier->service_end, __ATOMIC_RELAXED);
+      if (service_end > last_seen) last_seen = service_end;
+      long age = now - last_seen;
+      int stale = buffer > 0 && age > STALE_READING_PERIODS*period;
+
+      //If current cashier is close, skip.
+      //A stale reading can ask for a new cash desk, but
+      //  can't be the reason to close one.
       if (cashiers_map[i] == OPEN){
-        if (buffer<=args->cashiers_handler_args->director_too_few_customers) below_min++;
-        if (buffer>=args->cashiers_handler_args->director_too_many_customers) above_max++;
+        queued[cashier_class] += buffer;
+        if (stale) stale_readings++;
+        if (buffer<=args->cashiers_handler_args->director_too_few_customers && !stale) below_min[cashier_class]++;
+        if (buffer>=args->cashiers_handler_args->director_too_many_customers) above_max[cashier_class]++;
       }
 
       if (DEBUG>=2){
-        if (cashiers_map[i] == OPEN) printf("%d: %d\n", i, buffer);
+        if (cashiers_map[i] == OPEN) printf("%d: %d (%ld ms)\n", i, buffer, age);
         else printf("%d: CLOSE\n", i);
       }
 
     }
 
-    if (sighup_status || sigquit_status) break;
+    for (int c = 0; c<CASHIER_CLASSES; c++){
 
-    if (DEBUG>=2) printf("\nbelow_min: %d\tabove_max: %d\n", below_min, above_max);
-    if (DEBUG>=2) puts("====================\n");
+      if (class_size[c] == 0) continue;
 
-    //To make the supermarket more dynamic, on each turn this
-    //  "cashiers scheduler" can only close or open a cash desk.
-    //It wouldn't be a rational decision to both close a cash desk
-    //  and open another one at the same time
-    //We give priority to open a new cash desk.
-    if (above_max>=below_min){
-
-      //Choose a random queue to open (it they are not all open)
-      //One new queue is also opened if less then DIRECTOR_ABOVE_MAX_LIMIT
-      //  queues are above_max (but one is) and the total of open queue is
-      //  less then DIRECTOR_ABOVE_MAX_LIMIT
-      if (( above_max>=args->cashiers_handler_args->director_above_max_limit
-                && currently_open!=args->all_cashiers->count)
-        ||( above_max>0
-                && currently_open<args->cashiers_handler_args->director_above_max_limit ) ){
-
-        int index = rand_r(&seed) % args->all_cashiers->count;
-        while(cashiers_map[index] == OPEN){
-          index++;
-          index %= args->all_cashiers->count;
-        }
+      if (DEBUG>=2) printf("\nclass %d below_min: %d\tabove_max: %d\n", c, below_min[c], above_max[c]);
 
-        cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[index];
+      //The predictive and SLO schedulers open or close at
+      //  once every desk needed to reach their estimate
+      if (args->cashiers_handler_args->scheduler != SCHEDULER_THRESHOLDS){
 
-        XLOCK(current_cashier->status_mutex);
-        *(current_cashier->status) = OPEN;
-        XSIGNAL(current_cashier->status_closed);
-        XUNLOCK(current_cashier->status_mutex);
+        //Normal desks can also be added, up to the size of the table
+        int capacity = class_size[c];
+        if (c == CASHIER_NORMAL) capacity += args->all_cashiers->max_count - args->all_cashiers->count;
 
-        cashiers_map[index] = OPEN;
-        currently_open++;
+        int needed = 0;
+        if (args->cashiers_handler_args->scheduler == SCHEDULER_PREDICTIVE){
+          needed = predictive_desks(args, &predictive[c], c, currently_open[c],
+                          capacity, queued[c], period);
+        } else {
+          needed = slo_desks(args, &slo[c], c, currently_open[c], capacity, queued[c]);
+        }
 
-      }
+        while (currently_open[c] < needed
+                  && open_one(args, cashiers_map, c, currently_open, class_size, &seed)){
+          desks_opened[c]++;
+        }
 
-    } else {
+        while (currently_open[c] > needed){
+          close_cashier(args, cashiers_map, random_cashier(args, cashiers_map, c, OPEN, &seed));
+          currently_open[c]--;
+          desks_closed[c]++;
+        }
 
-      //Choose a random queue to close (if there is at least one still open)
-      if ( below_min>=args->cashiers_handler_args->director_below_min_limit && currently_open>1 ){
+        continue;
 
-        int index = rand_r(&seed) % args->all_cashiers->count;
-        while(cashiers_map[index] == CLOSE){
-          index++;
-          index %= args->all_cashiers->count;
-        }
+      }
 
-        XLOCK((args->all_cashiers->cashiers_list)[index]->status_mutex);
-        *((args->all_cashiers->cashiers_list)[index]->status) = CLOSE;
-        XUNLOCK((args->all_cashiers->cashiers_list)[index]->status_mutex);
-        cashiers_map[index] = CLOSE;
-        currently_open--;
+      //To make the supermarket more dynamic, on each turn this
+      //  "cashiers scheduler" can only close or open a cash desk.
+      //It wouldn't be a rational decision to both close a cash desk
+      //  and open another one at the same time
+      //We give priority to open a new cash desk.
+      if (above_max[c]>=below_min[c]){
 
-        queue_t* current_queue = (args->all_cashiers->cashiers_list)[index]->queue;
+        //Choose a random queue to open (it they are not all open,
+        //  otherwise a new one is added if the table has room)
+        //One new queue is also opened if less then DIRECTOR_ABOVE_MAX_LIMIT
+        //  queues are above_max (but one is) and the total of open queue is
+        //  less then DIRECTOR_ABOVE_MAX_LIMIT
+        if ( above_max[c]>=args->cashiers_handler_args->director_above_max_limit
+          ||( above_max[c]>0
+                  && currently_open[c]<args->cashiers_handler_args->director_above_max_limit ) ){
 
-        //Emptying the queue
-        XLOCK(current_queue->mutex);
+          open_one(args, cashiers_map, c, currently_open, class_size, &seed);
 
-        //No need to pass mutex as param since we
-        //  already manually locked it outside
-        int count = get_count_fifo(current_queue->fifo, NULL);
-        for (int i = 0; i<count; i++){
+        }
 
-          struct __customer_at_cashier* customer = pop_fifo(current_queue->fifo, NULL, NULL);
+      } else {
 
-          if (customer) {
+        //Choose a random queue to close (if there is at least one still open)
+        if ( below_min[c]>=args->cashiers_handler_args->director_below_min_limit && currently_open[c]>1 ){
 
-            XLOCK(customer->response_mutex);
-            *(customer->response) = 0;
-            XSIGNAL(customer->no_response);
-            XUNLOCK(customer->response_mutex);
-          
-            free(customer);
-          
-          }
+          close_cashier(args, cashiers_map, random_cashier(args, cashiers_map, c, OPEN, &seed));
+          currently_open[c]--;
 
         }
 
-        //"wake up" element in case cashier is stuck waiting
-        push_fifo(current_queue->fifo, NULL, NULL, current_queue->empty);
+      }
 
-        XUNLOCK(current_queue->mutex);
+    }
 
+    if (DEBUG>=2) puts("====================\n");
+
+    //Customers are moved once the desks of this round are open,
+    //  so that they can jockey to the new ones right away
+    if (args->cashiers_handler_args->jockey_margin > 0){
+      for (int c = 0; c<CASHIER_CLASSES; c++){
+        if (class_size[c] > 0) jockeyed_customers += rebalance_queues(args, cashiers_map, c);
       }
+    }
 
+    //With an elastic pool, the thread of a cashier closed for long
+    //  enough is stopped. The cashier stays in the table, so that
+    //  customers still looking at it never see it freed, and it can
+    //  be opened again with a new thread.
+    if (args->cashiers_handler_args->elastic_cashiers){
+      for (int i = 0; i<args->all_cashiers->count; i++){
+        cashier_t* current_cashier = (args->all_cashiers->cashiers_list)[i];
+        if (cashiers_map[i] != CLOSE || current_cashier->thread == 0) continue;
+        if (now - current_cashier->closed_since < ELASTIC_RETIRE_MSECS) continue;
+        cashier_retire(current_cashier);
+        retired_cashiers++;
+      }
     }
 
+    //Decision latency: from the deadline of the round to
+    //  the moment the decision has been applied
+    struct timespec round_end;
+    SYS_CALL(clock_gettime(CLOCK_MONOTONIC, &round_end), "clock_gettime");
+    struct timespec latency;
+    timespec_diff(&deadline, &round_end, &latency);
+    long latency_usecs = latency.tv_sec*MILLION + latency.tv_nsec/THOUSAND;
+    if (latency_usecs < 0) latency_usecs = 0;
+    total_latency += latency_usecs;
+    if (latency_usecs > max_latency) max_latency = latency_usecs;
+    rounds++;
+
+  }
+
+  xlog_printf(args->log, "Cashiers handler: %ld rounds every %d ms, %ld periods missed, "
+            "%ld stale readings\n", rounds, period, missed_periods, stale_readings);
+  if (args->cashiers_handler_args->jockey_margin > 0){
+    xlog_printf(args->log, "Cashiers handler: %ld customers jockeyed to a shorter queue\n",
+              jockeyed_customers);
+  }
+  for (int c = 0; c<CASHIER_CLASSES; c++){
+    if (class_size[c] == 0) continue;
+    if (args->cashiers_handler_args->scheduler == SCHEDULER_PREDICTIVE){
+      xlog_printf(args->log, "Predictive scheduler (class %d): %.1f arrivals/s, %.1f ms of service, "
+                "%ld desks opened, %ld closed\n", c, predictive[c].arrival_rate*THOUSAND,
+                predictive[c].service_time, desks_opened[c], desks_closed[c]);
+    } else if (args->cashiers_handler_args->scheduler == SCHEDULER_SLO){
+      xlog_printf(args->log, "SLO scheduler (class %d): p%d of the queue wait %ld ms (SLO %d ms), "
+                "%ld rounds over the SLO, %ld desks opened, %ld closed\n", c,
+                args->cashiers_handler_args->slo_percentile, slo[c].percentile,
+                args->cashiers_handler_args->target_wait, slo[c].breaches,
+                desks_opened[c], desks_closed[c]);
+      rolling_histogram_free(&slo[c].queue_wait);
+    }
+  }
+  if (args->cashiers_handler_args->elastic_cashiers){
+    xlog_printf(args->log, "Elastic cashiers: %d added (%d in total), %ld threads retired\n",
+              args->all_cashiers->count - initial_count, args->all_cashiers->count,
+              retired_cashiers);
   }
+  xlog_printf(args->log, "Cashiers handler decision latency: %ld us average, %ld us max\n",
+            rounds ? total_latency/rounds : 0, max_latency);
 
   //Signaling cashiers that might be stuck because they are closed
   for (int i=0; i<args->all_cashiers->count; i++){
@@ -282,8 +918,7 @@ void* cashiers_handler(void* args_pointer){
 
   //Waking up the director in case he is waiting giving
   //  permissions to customers
-  push_fifo(args->director_permissions_list->fifo, NULL,
-    args->director_permissions_list->mutex, args->director_permissions_list->empty);
+  queue_wake_up(args->director_permissions_list);
 
   return NULL;
 
@@ -0,0 +1,247 @@
+#include <fifo_mpsc.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <utils.h>
+#include <stdio.h>
+
+//Takes a node from the pool, or allocates a new one if the pool is empty.
+//The whole pool is taken with an exchange (so there is no ABA problem
+//  between concurrent producers) and what remains is given back.
+//If another producer is holding the whole pool for a moment a new
+//  node is allocated right away, as fifo_unbounded_t does.
+static struct __node* get_node(fifo_mpsc_t* fifo){
+
+  struct __node* res = __atomic_exchange_n(&fifo->free_list, NULL, __ATOMIC_ACQUIRE);
+
+  if (!res){
+    __atomic_add_fetch(&fifo->stats.allocated_nodes, 1, __ATOMIC_RELAXED);
+    res = xmalloc(sizeof(struct __node));
+    res->intrusive = 0;
+    return res;
+  }
+
+  __atomic_add_fetch(&fifo->stats.reused_nodes, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&fifo->stats.free_nodes, 1, __ATOMIC_RELAXED);
+
+  struct __node* rest = res->next;
+  if (!rest) return res;
+
+  //Usually nobody refilled the pool in the meantime
+  struct __node* expected = NULL;
+  if (__atomic_compare_exchange_n(&fifo->free_list, &expected, rest, 0,
+                                  __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+    return res;
+  }
+
+  struct __node* last = rest;
+  while (last->next) last = last->next;
+
+  do {
+    last->next = expected;
+  } while (!__atomic_compare_exchange_n(&fifo->free_list, &expected, rest, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  return res;
+
+}
+
+//Gives back a node to the pool.
+static void release_node(fifo_mpsc_t* fifo, struct __node* node){
+
+  node->elem = NULL;
+  node->next = __atomic_load_n(&fifo->free_list, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&fifo->free_list, &node->next, node, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+  __atomic_add_fetch(&fifo->stats.free_nodes, 1, __ATOMIC_RELAXED);
+
+}
+
+static void link_node(fifo_mpsc_t* fifo, struct __node* node){
+
+  node->next = NULL;
+  struct __node* prev = __atomic_exchange_n(&fifo->head, node, __ATOMIC_ACQ_REL);
+  //Between the exchange and this store the queue is "broken":
+  //  the consumer can see the new head but not reach it yet.
+  __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+
+}
+
+
+int fifo_mpsc_init(fifo_mpsc_t* fifo){
+
+  fifo->stub.elem = NULL;
+  fifo->stub.next = NULL;
+  fifo->stub.intrusive = 1;
+  fifo->head = &fifo->stub;
+  fifo->tail = &fifo->stub;
+  fifo->count = 0;
+  fifo->sleeping = 0;
+  CHECK_ERR(pthread_mutex_init(&fifo->mutex, NULL), "mutex init");
+  CHECK_ERR(pthread_cond_init(&fifo->empty, NULL), "cond init");
+
+  fifo->free_list = NULL;
+  fifo->stats.allocated_nodes = 0;
+  fifo->stats.reused_nodes = 0;
+  fifo->stats.free_nodes = 0;
+  fifo->stats.full_pushes = 0;
+
+  return 0;
+
+}
+
+
+int fifo_mpsc_reserve(fifo_mpsc_t* fifo, int nodes){
+
+  for (int i = 0; i<nodes; i++){
+    struct __node* node = xmalloc(sizeof(struct __node));
+    node->intrusive = 0;
+    release_node(fifo, node);
+    __atomic_add_fetch(&fifo->stats.allocated_nodes, 1, __ATOMIC_RELAXED);
+  }
+
+  return 0;
+
+}
+
+
+void push_mpsc(fifo_mpsc_t* fifo, void* elem){
+
+  struct __node* new_node = get_node(fifo);
+  new_node->elem = elem;
+
+  push_node_mpsc(fifo, new_node);
+
+}
+
+
+void push_node_mpsc(fifo_mpsc_t* fifo, struct __node* node){
+
+  link_node(fifo, node);
+  __atomic_add_fetch(&fifo->count, 1, __ATOMIC_RELAXED);
+
+  //Pairs with the fence in pop_mpsc(): either the consumer sees
+  //  the new node, or we see that it is going to sleep.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&fifo->sleeping, __ATOMIC_RELAXED)){
+    pthread_mutex_lock(&fifo->mutex);
+    pthread_cond_signal(&fifo->empty);
+    pthread_mutex_unlock(&fifo->mutex);
+  }
+
+}
+
+
+int try_pop_mpsc(fifo_mpsc_t* fifo, void** elem){
+
+  struct __node* tail = fifo->tail;
+  struct __node* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+  //Skipping the stub node. If a producer is in the middle of a push
+  //  its node can't be reached yet: the queue is reported as empty,
+  //  and the producer will wake us up in pop_mpsc() once it is done.
+  if (tail == &fifo->stub){
+    if (!next) return 0;
+    fifo->tail = next;
+    tail = next;
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+  }
+
+  if (!next){
+
+    //tail is the last node: to remove it the stub is
+    //  pushed behind it, so that tail->next becomes valid.
+    if (__atomic_load_n(&fifo->head, __ATOMIC_ACQUIRE) == tail){
+      link_node(fifo, &fifo->stub);
+    }
+
+    //Still NULL only if another producer is linking its node right
+    //  after tail: tail is left where it is and taken next time.
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (!next) return 0;
+
+  }
+
+  fifo->tail = next;
+  *elem = tail->elem;
+  __atomic_sub_fetch(&fifo->count, 1, __ATOMIC_RELAXED);
+
+  if (!tail->intrusive) release_node(fifo, tail);
+
+  return 1;
+
+}
+
+
+void* pop_mpsc(fifo_mpsc_t* fifo){
+
+  void* res = NULL;
+
+  if (try_pop_mpsc(fifo, &res)) return res;
+
+  pthread_mutex_lock(&fifo->mutex);
+  __atomic_store_n(&fifo->sleeping, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  while (!try_pop_mpsc(fifo, &res)){
+    pthread_cond_wait(&fifo->empty, &fifo->mutex);
+  }
+
+  __atomic_store_n(&fifo->sleeping, 0, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&fifo->mutex);
+
+  return res;
+
+}
+
+
+int get_count_mpsc(fifo_mpsc_t* fifo){
+
+  int res = __atomic_load_n(&fifo->count, __ATOMIC_RELAXED);
+
+  //Producers increase the counter after linking the node,
+  //  so it can be briefly negative.
+  return res < 0 ? 0 : res;
+
+}
+
+
+void get_stats_mpsc(fifo_mpsc_t* fifo, struct __fifo_stats* stats){
+
+  stats->allocated_nodes = __atomic_load_n(&fifo->stats.allocated_nodes, __ATOMIC_RELAXED);
+  stats->reused_nodes = __atomic_load_n(&fifo->stats.reused_nodes, __ATOMIC_RELAXED);
+  stats->free_nodes = __atomic_load_n(&fifo->stats.free_nodes, __ATOMIC_RELAXED);
+  stats->full_pushes = 0;
+
+}
+
+
+void free_mpsc(fifo_mpsc_t* fifo){
+
+  //try_pop_mpsc() can't tell us if the node was embedded
+  //  in the element, so we walk the list by ourselves.
+  struct __node* node = fifo->tail;
+  while (node){
+    struct __node* next = node->next;
+    if (!node->intrusive){
+      free(node->elem);
+      free(node);
+    }
+    node = next;
+  }
+  fifo->head = &fifo->stub;
+  fifo->tail = &fifo->stub;
+  fifo->stub.next = NULL;
+  fifo->count = 0;
+
+  while (fifo->free_list){
+    struct __node* temp = fifo->free_list;
+    fifo->free_list = fifo->free_list->next;
+    free(temp);
+  }
+
+  fifo->stats.free_nodes = 0;
+
+  pthread_mutex_destroy(&fifo->mutex);
+  pthread_cond_destroy(&fifo->empty);
+
+}
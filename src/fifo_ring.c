@@ -0,0 +1,206 @@
+#include <fifo_ring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <utils.h>
+#include <stdio.h>
+
+
+int fifo_ring_init(fifo_ring_t* ring, int capacity){
+
+  size_t size = 2;
+  while (size < (size_t)capacity) size <<= 1;
+
+  ring->cells = xmalloc(sizeof(struct __ring_cell)*size);
+  for (size_t i = 0; i<size; i++){
+    ring->cells[i].sequence = i;
+    ring->cells[i].elem = NULL;
+  }
+  ring->mask = size-1;
+  ring->enqueue_pos = 0;
+  ring->dequeue_pos = 0;
+  ring->push_waiting = 0;
+  ring->pop_waiting = 0;
+  ring->full_pushes = 0;
+  CHECK_ERR(pthread_mutex_init(&ring->mutex, NULL), "mutex init");
+  CHECK_ERR(pthread_cond_init(&ring->not_full, NULL), "cond init");
+  CHECK_ERR(pthread_cond_init(&ring->not_empty, NULL), "cond init");
+
+  return 0;
+
+}
+
+
+//Wakes up the threads parked on cond, if any. The fence pairs with
+//  the one done by the parking thread after announcing itself.
+static void wake_up(fifo_ring_t* ring, int* waiting, pthread_cond_t* cond){
+
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED)){
+    pthread_mutex_lock(&ring->mutex);
+    pthread_cond_broadcast(cond);
+    pthread_mutex_unlock(&ring->mutex);
+  }
+
+}
+
+
+static int enqueue(fifo_ring_t* ring, void* elem){
+
+  size_t pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+
+  for (;;){
+
+    struct __ring_cell* cell = &ring->cells[pos & ring->mask];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    long diff = (long)sequence - (long)pos;
+
+    if (diff == 0){
+      if (__atomic_compare_exchange_n(&ring->enqueue_pos, &pos, pos+1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+        cell->elem = elem;
+        __atomic_store_n(&cell->sequence, pos+1, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (diff < 0){
+      //The cell still holds an element of the previous lap
+      return 0;
+    } else {
+      pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+    }
+
+  }
+
+}
+
+
+static int dequeue(fifo_ring_t* ring, void** elem){
+
+  size_t pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+
+  for (;;){
+
+    struct __ring_cell* cell = &ring->cells[pos & ring->mask];
+    size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+    long diff = (long)sequence - (long)(pos+1);
+
+    if (diff == 0){
+      if (__atomic_compare_exchange_n(&ring->dequeue_pos, &pos, pos+1, 1,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+        *elem = cell->elem;
+        __atomic_store_n(&cell->sequence, pos+ring->mask+1, __ATOMIC_RELEASE);
+        return 1;
+      }
+    } else if (diff < 0){
+      //The cell hasn't been written yet
+      return 0;
+    } else {
+      pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+    }
+
+  }
+
+}
+
+
+int try_push_ring(fifo_ring_t* ring, void* elem){
+
+  if (!enqueue(ring, elem)){
+    __atomic_add_fetch(&ring->full_pushes, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  wake_up(ring, &ring->pop_waiting, &ring->not_empty);
+
+  return 1;
+
+}
+
+
+void push_ring(fifo_ring_t* ring, void* elem){
+
+  if (try_push_ring(ring, elem)) return;
+
+  pthread_mutex_lock(&ring->mutex);
+  __atomic_add_fetch(&ring->push_waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  while (!enqueue(ring, elem)){
+    pthread_cond_wait(&ring->not_full, &ring->mutex);
+  }
+
+  __atomic_sub_fetch(&ring->push_waiting, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&ring->mutex);
+
+  wake_up(ring, &ring->pop_waiting, &ring->not_empty);
+
+}
+
+
+int try_pop_ring(fifo_ring_t* ring, void** elem){
+
+  if (!dequeue(ring, elem)) return 0;
+
+  wake_up(ring, &ring->push_waiting, &ring->not_full);
+
+  return 1;
+
+}
+
+
+void* pop_ring(fifo_ring_t* ring){
+
+  void* res = NULL;
+
+  if (try_pop_ring(ring, &res)) return res;
+
+  pthread_mutex_lock(&ring->mutex);
+  __atomic_add_fetch(&ring->pop_waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  while (!dequeue(ring, &res)){
+    pthread_cond_wait(&ring->not_empty, &ring->mutex);
+  }
+
+  __atomic_sub_fetch(&ring->pop_waiting, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&ring->mutex);
+
+  wake_up(ring, &ring->push_waiting, &ring->not_full);
+
+  return res;
+
+}
+
+
+int get_count_ring(fifo_ring_t* ring){
+
+  size_t dequeue_pos = __atomic_load_n(&ring->dequeue_pos, __ATOMIC_RELAXED);
+  size_t enqueue_pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+  long res = (long)enqueue_pos - (long)dequeue_pos;
+
+  if (res < 0) return 0;
+  if (res > (long)ring->mask+1) return ring->mask+1;
+  return res;
+
+}
+
+
+int get_capacity_ring(fifo_ring_t* ring){
+
+  return ring->mask+1;
+
+}
+
+
+void free_ring(fifo_ring_t* ring){
+
+  void* elem;
+  while (dequeue(ring, &elem)){
+    free(elem);
+  }
+
+  free(ring->cells);
+  pthread_mutex_destroy(&ring->mutex);
+  pthread_cond_destroy(&ring->not_full);
+  pthread_cond_destroy(&ring->not_empty);
+
+}
@@ -1,28 +1,95 @@
 #include <fifo_unbounded.h>
+#include <errno.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <utils.h>
 #include <stdio.h>
+#include <time.h>
+
+//Takes a node from the pool, or allocates a new one if the
+//  pool is empty. Must be called with the fifo already locked.
+static struct __node* get_node(fifo_unbounded_t* fifo){
+
+  struct __node* res = fifo->free_list;
+
+  if (res){
+    fifo->free_list = res->next;
+    fifo->stats.free_nodes--;
+    fifo->stats.reused_nodes++;
+  } else {
+    res = xmalloc(sizeof(struct __node));
+    res->intrusive = 0;
+    fifo->stats.allocated_nodes++;
+  }
+
+  return res;
+
+}
+
+//Gives back a node to the pool.
+//Must be called with the fifo already locked.
+static void release_node(fifo_unbounded_t* fifo, struct __node* node){
+
+  node->elem = NULL;
+  node->next = fifo->free_list;
+  fifo->free_list = node;
+  fifo->stats.free_nodes++;
+
+}
+
+
+//The count is always modified under the fifo lock, but it is
+//  written atomically so that get_depth_fifo() can read it without.
+static void set_count(fifo_unbounded_t* fifo, int count){
+
+  __atomic_store_n(&fifo->count, count, __ATOMIC_RELAXED);
+
+}
+
 
 int fifo_init(fifo_unbounded_t* fifo){
 
   fifo->head = NULL;
   fifo->tail = NULL;
-  fifo->count = 0;
+  set_count(fifo, 0);
+
+  fifo->free_list = NULL;
+  fifo->stats.allocated_nodes = 0;
+  fifo->stats.reused_nodes = 0;
+  fifo->stats.free_nodes = 0;
+  fifo->stats.full_pushes = 0;
 
   return 0;
 
 }
 
 
-void push_fifo(fifo_unbounded_t* fifo, void* elem, pthread_mutex_t* mutex, pthread_cond_t* empty){
-
-  struct __node* new_node = xmalloc(sizeof(struct __node));
-  new_node->elem = elem;
-  new_node->next = NULL;
+int fifo_reserve(fifo_unbounded_t* fifo, int nodes, pthread_mutex_t* mutex){
 
   if (mutex) pthread_mutex_lock(mutex);
 
+  for (int i = 0; i<nodes; i++){
+    struct __node* node = xmalloc(sizeof(struct __node));
+    node->intrusive = 0;
+    release_node(fifo, node);
+    fifo->stats.allocated_nodes++;
+  }
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+  return 0;
+
+}
+
+
+//Links a node at the tail. Must be called with the fifo already locked.
+static void append_node(fifo_unbounded_t* fifo, struct __node* new_node){
+
+  new_node->next = NULL;
+  new_node->prev = fifo->tail;
+  new_node->key = 0;
+
   //If is empty
   if (!fifo->head){
     fifo->head = new_node;
@@ -32,54 +99,432 @@ void push_fifo(fifo_unbounded_t* fifo, void* elem, pthread_mutex_t* mutex, pthre
 
   fifo->tail = new_node;
 
-  fifo->count++;
+  set_count(fifo, fifo->count+1);
+
+}
+
+
+void fifo_node_init(struct __node* node, void* elem){
+
+  node->elem = elem;
+  node->next = NULL;
+  node->prev = NULL;
+  node->intrusive = 1;
+
+}
+
+
+void push_fifo(fifo_unbounded_t* fifo, void* elem, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  struct __node* new_node = get_node(fifo);
+  new_node->elem = elem;
+  append_node(fifo, new_node);
 
   if (empty) pthread_cond_signal(empty);
 
   if (mutex) pthread_mutex_unlock(mutex);
 
+}
+
+
+void push_node_fifo(fifo_unbounded_t* fifo, struct __node* node, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  append_node(fifo, node);
+
+  if (empty) pthread_cond_signal(empty);
+
+  if (mutex) pthread_mutex_unlock(mutex);
 
 }
 
 
-void* pop_fifo(fifo_unbounded_t* fifo, pthread_mutex_t* mutex, pthread_cond_t* empty){
+void push_node_sorted_fifo(fifo_unbounded_t* fifo, struct __node* node, long key,
+            pthread_mutex_t* mutex, pthread_cond_t* empty){
 
   if (mutex) pthread_mutex_lock(mutex);
 
-  while (!fifo->head && mutex && empty){
-    pthread_cond_wait(empty, mutex);
-  }
+  node->key = key;
 
-  if (!fifo->head && (!mutex || !empty)){
-    return NULL;
+  //A "wake up" element has no priority of its own: the customers
+  //  are only compared with each other
+  struct __node* after = fifo->tail;
+  while (after && (!after->elem || after->key > key)) after = after->prev;
+
+  node->prev = after;
+  if (after){
+    node->next = after->next;
+    after->next = node;
+  } else {
+    node->next = fifo->head;
+    fifo->head = node;
   }
+  if (node->next) node->next->prev = node;
+  else fifo->tail = node;
+
+  set_count(fifo, fifo->count+1);
+
+  if (empty) pthread_cond_signal(empty);
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+}
+
+
+//Removes the head of a non empty fifo and returns its element.
+//  Must be called with the fifo already locked.
+static void* unlink_head(fifo_unbounded_t* fifo){
 
   void* res = (fifo->head)->elem;
 
   struct __node* temp = fifo->head;
   fifo->head = (fifo->head)->next;
   if (!fifo->head) fifo->tail = NULL;
+  else fifo->head->prev = NULL;
+
+  set_count(fifo, fifo->count-1);
+
+  if (!temp->intrusive) release_node(fifo, temp);
+
+  return res;
+
+}
+
+
+void* pop_fifo(fifo_unbounded_t* fifo, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  return pop_fifo_while(fifo, NULL, mutex, empty);
+
+}
+
+
+void* pop_fifo_while(fifo_unbounded_t* fifo, int* flag, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  //The flag is written outside of the fifo lock, so it is read atomically
+  while (!fifo->head && mutex && empty && (!flag || __atomic_load_n(flag, __ATOMIC_RELAXED))){
+    pthread_cond_wait(empty, mutex);
+  }
 
-  fifo->count--;
+  void* res = fifo->head ? unlink_head(fifo) : NULL;
 
   if (mutex) pthread_mutex_unlock(mutex);
 
-  free(temp);
+  return res;
+
+}
+
+
+int pop_fifo_timed(fifo_unbounded_t* fifo, void** elem, int msecs, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  //The condition variables of the fifos use the default clock
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += msecs/THOUSAND;
+  deadline.tv_nsec += (msecs%THOUSAND)*MILLION;
+  if (deadline.tv_nsec >= BILLION){
+    deadline.tv_sec++;
+    deadline.tv_nsec -= BILLION;
+  }
+
+  pthread_mutex_lock(mutex);
+
+  int timed_out = 0;
+  while (!fifo->head && !timed_out){
+    timed_out = pthread_cond_timedwait(empty, mutex, &deadline) == ETIMEDOUT;
+  }
+
+  int res = 0;
+  if (fifo->head){
+    *elem = unlink_head(fifo);
+    res = 1;
+  }
+
+  pthread_mutex_unlock(mutex);
 
   return res;
 
 }
 
 
+int steal_tail_fifo(fifo_unbounded_t* fifo, void** elem, pthread_mutex_t* mutex){
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  struct __node* node = fifo->tail;
+
+  //A "wake up" element is left to its owner
+  if (!node || !node->elem){
+    if (mutex) pthread_mutex_unlock(mutex);
+    return 0;
+  }
+
+  fifo->tail = node->prev;
+  if (!fifo->tail) fifo->head = NULL;
+  else fifo->tail->next = NULL;
+
+  set_count(fifo, fifo->count-1);
+
+  *elem = node->elem;
+  if (!node->intrusive) release_node(fifo, node);
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+  return 1;
+
+}
+
+
+int steal_head_fifo(fifo_unbounded_t* fifo, void** elem, pthread_mutex_t* mutex){
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  //A "wake up" element is left to its owner
+  if (!fifo->head || !fifo->head->elem){
+    if (mutex) pthread_mutex_unlock(mutex);
+    return 0;
+  }
+
+  *elem = unlink_head(fifo);
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+  return 1;
+
+}
+
+
+void wake_all_fifo(pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  pthread_mutex_lock(mutex);
+  pthread_cond_broadcast(empty);
+  pthread_mutex_unlock(mutex);
+
+}
+
+
+void fifo_chain_init(fifo_chain_t* chain){
+
+  chain->head = NULL;
+  chain->tail = NULL;
+  chain->count = 0;
+  chain->spare_head = NULL;
+  chain->spare_tail = NULL;
+  chain->spare_count = 0;
+
+}
+
+
+void push_chain(fifo_chain_t* chain, struct __node* node){
+
+  node->next = NULL;
+  node->prev = chain->tail;
+
+  if (!chain->head){
+    chain->head = node;
+  } else {
+    chain->tail->next = node;
+  }
+
+  chain->tail = node;
+  chain->count++;
+
+}
+
+
+void splice_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  if (!chain->head) return;
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  chain->head->prev = fifo->tail;
+
+  if (!fifo->head){
+    fifo->head = chain->head;
+  } else {
+    (fifo->tail)->next = chain->head;
+  }
+
+  fifo->tail = chain->tail;
+  set_count(fifo, fifo->count + chain->count);
+
+  if (empty) pthread_cond_signal(empty);
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+  chain->head = NULL;
+  chain->tail = NULL;
+  chain->count = 0;
+
+}
+
+
+void merge_chain_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  if (!chain->head) return;
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  struct __node* current = fifo->head;
+  struct __node* last = NULL;
+  struct __node* node = chain->head;
+
+  while (node){
+    struct __node* next = node->next;
+    //Equal keys keep the ones already in the fifo first,
+    //  and "wake up" elements are not compared
+    while (current && (!current->elem || current->key <= node->key)){
+      last = current;
+      current = current->next;
+    }
+    node->prev = last;
+    node->next = current;
+    if (last) last->next = node;
+    else fifo->head = node;
+    if (current) current->prev = node;
+    else fifo->tail = node;
+    last = node;
+    node = next;
+  }
+
+  set_count(fifo, fifo->count + chain->count);
+
+  if (empty) pthread_cond_signal(empty);
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+  chain->head = NULL;
+  chain->tail = NULL;
+  chain->count = 0;
+
+}
+
+
+int pop_many_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, int max, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  fifo_chain_init(chain);
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  while (!fifo->head && mutex && empty){
+    pthread_cond_wait(empty, mutex);
+  }
+
+  if (fifo->head && max > 0){
+
+    chain->head = fifo->head;
+
+    //Taking everything doesn't need to walk the list
+    if (max >= fifo->count){
+      chain->tail = fifo->tail;
+      chain->count = fifo->count;
+    } else {
+      struct __node* last = fifo->head;
+      for (int i = 1; i<max; i++) last = last->next;
+      chain->tail = last;
+      chain->count = max;
+    }
+
+    fifo->head = chain->tail->next;
+    if (!fifo->head) fifo->tail = NULL;
+    else fifo->head->prev = NULL;
+    set_count(fifo, fifo->count - chain->count);
+    chain->tail->next = NULL;
+
+  }
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+  return chain->count;
+
+}
+
+
+int drain_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex, pthread_cond_t* empty){
+
+  return pop_many_fifo(fifo, chain, INT_MAX, mutex, empty);
+
+}
+
+
+int pop_chain(fifo_chain_t* chain, void** elem){
+
+  struct __node* node = chain->head;
+  if (!node) return 0;
+
+  //The next node must be read before handing out the element:
+  //  an intrusive node can be reused as soon as its owner is answered.
+  chain->head = node->next;
+  if (!chain->head) chain->tail = NULL;
+  chain->count--;
+  *elem = node->elem;
+
+  if (!node->intrusive){
+    node->elem = NULL;
+    node->next = chain->spare_head;
+    chain->spare_head = node;
+    if (!chain->spare_tail) chain->spare_tail = node;
+    chain->spare_count++;
+  }
+
+  return 1;
+
+}
+
+
+void release_chain_fifo(fifo_unbounded_t* fifo, fifo_chain_t* chain, pthread_mutex_t* mutex){
+
+  if (!chain->spare_head) return;
+
+  if (mutex) pthread_mutex_lock(mutex);
+
+  chain->spare_tail->next = fifo->free_list;
+  fifo->free_list = chain->spare_head;
+  fifo->stats.free_nodes += chain->spare_count;
+
+  if (mutex) pthread_mutex_unlock(mutex);
+
+  chain->spare_head = NULL;
+  chain->spare_tail = NULL;
+  chain->spare_count = 0;
+
+}
+
+
 void free_fifo(fifo_unbounded_t* fifo){
 
   while(fifo->head){
     struct __node* temp = fifo->head;
     fifo->head = fifo->head->next;
-    free(temp->elem);
+    if (!temp->intrusive){
+      free(temp->elem);
+      free(temp);
+    }
+  }
+
+  fifo->tail = NULL;
+  set_count(fifo, 0);
+
+  while(fifo->free_list){
+    struct __node* temp = fifo->free_list;
+    fifo->free_list = fifo->free_list->next;
     free(temp);
   }
 
+  fifo->stats.free_nodes = 0;
+
+}
+
+
+int get_depth_fifo(fifo_unbounded_t* fifo){
+
+  return __atomic_load_n(&fifo->count, __ATOMIC_RELAXED);
+
 }
 
 
@@ -92,3 +537,12 @@ int get_count_fifo(fifo_unbounded_t* fifo, pthread_mutex_t* mutex){
   return res;
 
 }
+
+
+void get_stats_fifo(fifo_unbounded_t* fifo, struct __fifo_stats* stats, pthread_mutex_t* mutex){
+
+  if (mutex) pthread_mutex_lock(mutex);
+  *stats = fifo->stats;
+  if (mutex) pthread_mutex_unlock(mutex);
+
+}
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <histogram.h>
+#include <utils.h>
+
+
+void histogram_init(histogram_t* histogram){
+
+  memset(histogram->counts, 0, sizeof(histogram->counts));
+
+}
+
+
+void histogram_record(histogram_t* histogram, long msecs){
+
+  long bucket = msecs / HISTOGRAM_BUCKET_MSECS;
+  if (bucket < 0) bucket = 0;
+  if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS-1;
+
+  __atomic_add_fetch(&histogram->counts[bucket], 1, __ATOMIC_RELAXED);
+
+}
+
+
+void rolling_histogram_init(rolling_histogram_t* rolling, histogram_t* histogram, int rounds_count){
+
+  memset(rolling->window, 0, sizeof(rolling->window));
+  rolling->window_count = 0;
+  rolling->rounds = xmalloc(sizeof(*rolling->rounds)*rounds_count);
+  memset(rolling->rounds, 0, sizeof(*rolling->rounds)*rounds_count);
+  rolling->rounds_count = rounds_count;
+  rolling->next_round = 0;
+
+  //Values recorded before the first round are not part of the window
+  for (int i = 0; i<HISTOGRAM_BUCKETS; i++){
+    rolling->last[i] = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+  }
+
+}
+
+
+void rolling_histogram_free(rolling_histogram_t* rolling){
+
+  free(rolling->rounds);
+
+}
+
+
+void rolling_histogram_update(rolling_histogram_t* rolling, histogram_t* histogram){
+
+  //The oldest round is overwritten by the new one
+  long* round = rolling->rounds[rolling->next_round];
+
+  for (int i = 0; i<HISTOGRAM_BUCKETS; i++){
+
+    long count = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    long added = count - rolling->last[i];
+    rolling->last[i] = count;
+
+    rolling->window[i] += added - round[i];
+    rolling->window_count += added - round[i];
+    round[i] = added;
+
+  }
+
+  rolling->next_round = (rolling->next_round+1) % rolling->rounds_count;
+
+}
+
+
+long rolling_histogram_percentile(rolling_histogram_t* rolling, int percentile){
+
+  if (rolling->window_count == 0) return 0;
+
+  //Number of values that must be at or below the result
+  long rank = (rolling->window_count*percentile + 99) / 100;
+  if (rank < 1) rank = 1;
+
+  long seen = 0;
+  for (int i = 0; i<HISTOGRAM_BUCKETS; i++){
+    seen += rolling->window[i];
+    if (seen >= rank) return (long)(i+1)*HISTOGRAM_BUCKET_MSECS;
+  }
+
+  return (long)HISTOGRAM_BUCKETS*HISTOGRAM_BUCKET_MSECS;
+
+}
+
+
+void latency_histogram_init(latency_histogram_t* histogram){
+
+  memset(histogram, 0, sizeof(latency_histogram_t));
+
+}
+
+
+static int latency_bucket(long usecs){
+
+  if (usecs < 0) usecs = 0;
+  if (usecs >= 1L << LATENCY_MAX_BITS) usecs = (1L << LATENCY_MAX_BITS) - 1;
+  if (usecs < 2*LATENCY_SUB_BUCKETS) return usecs;
+
+  //The value is shifted so that it keeps LATENCY_SUB_BITS+1 bits
+  int magnitude = 63 - __builtin_clzl(usecs) - LATENCY_SUB_BITS;
+
+  return (magnitude+1)*LATENCY_SUB_BUCKETS + (usecs >> magnitude) - LATENCY_SUB_BUCKETS;
+
+}
+
+
+//Largest value counted in the bucket
+static long latency_bucket_end(int bucket){
+
+  if (bucket < 2*LATENCY_SUB_BUCKETS) return bucket;
+
+  int magnitude = bucket/LATENCY_SUB_BUCKETS - 1;
+  long sub_bucket = bucket%LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+
+  return ((sub_bucket+1) << magnitude) - 1;
+
+}
+
+
+void latency_histogram_record(latency_histogram_t* histogram, long usecs){
+
+  if (usecs < 0) usecs = 0;
+
+  __atomic_add_fetch(&histogram->counts[latency_bucket(usecs)], 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&histogram->sum, usecs, __ATOMIC_RELAXED);
+
+  long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+  while (usecs > max && !__atomic_compare_exchange_n(&histogram->max, &max, usecs,
+              1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+}
+
+
+long latency_histogram_percentile(latency_histogram_t* histogram, double percentile){
+
+  //The buckets are summed instead of reading count, so
+  //  that a value being recorded is either in both or in none
+  long counts[LATENCY_BUCKETS];
+  long total = 0;
+  for (int i = 0; i<LATENCY_BUCKETS; i++){
+    counts[i] = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    total += counts[i];
+  }
+
+  if (total == 0) return 0;
+
+  //Number of values that must be at or below the result
+  long rank = (long)(total*percentile/100 + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank > total) rank = total;
+
+  long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+  long seen = 0;
+  for (int i = 0; i<LATENCY_BUCKETS; i++){
+    seen += counts[i];
+    if (seen >= rank){
+      long end = latency_bucket_end(i);
+      return end < max ? end : max;
+    }
+  }
+
+  return max;
+
+}
+
+
+void latency_histogram_print_header(struct __xlog* log, const char* title){
+
+  xlog_printf(log, "%s (ms):\n", title);
+  xlog_printf(log, "  %-20s %8s %10s %10s %10s %10s %10s %10s\n", "", "count",
+            "mean", "p50", "p90", "p99", "p99.9", "max");
+
+}
+
+
+void latency_histogram_print(latency_histogram_t* histogram, struct __xlog* log, const char* name){
+
+  long count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+  long sum = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+
+  xlog_printf(log, "  %-20s %8ld %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", name, count,
+            count ? (double)sum/count/THOUSAND : 0.0,
+            latency_histogram_percentile(histogram, 50)/(double)THOUSAND,
+            latency_histogram_percentile(histogram, 90)/(double)THOUSAND,
+            latency_histogram_percentile(histogram, 99)/(double)THOUSAND,
+            latency_histogram_percentile(histogram, 99.9)/(double)THOUSAND,
+            __atomic_load_n(&histogram->max, __ATOMIC_RELAXED)/(double)THOUSAND);
+
+}
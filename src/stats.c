@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+
+#include <stats.h>
+#include <utils.h>
+
+_Static_assert(sizeof(struct __stats_shard) % CACHE_LINE_SIZE == 0,
+          "a stats shard must fill whole cache lines");
+
+
+void stats_init(stats_t* stats, int cashiers_count){
+
+  stats->shards_count = cashiers_count+1;
+
+  //Aligned, so that each shard starts its own cache line
+  void* shards = NULL;
+  int err = posix_memalign(&shards, CACHE_LINE_SIZE,
+                sizeof(struct __stats_shard)*stats->shards_count);
+  if (err){
+    errno = err;
+    perror("posix_memalign");
+    exit(EXIT_FAILURE);
+  }
+
+  memset(shards, 0, sizeof(struct __stats_shard)*stats->shards_count);
+  stats->shards = shards;
+
+}
+
+
+void stats_free(stats_t* stats){
+
+  free(stats->shards);
+  stats->shards = NULL;
+
+}
+
+
+void stats_add(stats_t* stats, int cashier_id, int counter, long value){
+
+  __atomic_add_fetch(&stats->shards[cashier_id].counters[counter], value, __ATOMIC_RELAXED);
+
+}
+
+
+void stats_add_director(stats_t* stats, int counter, long value){
+
+  stats_add(stats, stats->shards_count-1, counter, value);
+
+}
+
+
+long stats_read(stats_t* stats, int counter){
+
+  long total = 0;
+  for (int i = 0; i<stats->shards_count; i++){
+    total += __atomic_load_n(&stats->shards[i].counters[counter], __ATOMIC_RELAXED);
+  }
+
+  return total;
+
+}
+
+
+void stats_snapshot(stats_t* stats, long* totals){
+
+  memset(totals, 0, sizeof(long)*STATS_COUNTERS);
+
+  for (int i = 0; i<stats->shards_count; i++){
+    for (int j = 0; j<STATS_COUNTERS; j++){
+      totals[j] += __atomic_load_n(&stats->shards[i].counters[j], __ATOMIC_RELAXED);
+    }
+  }
+
+}
+
+
+void stats_print(stats_t* stats, struct __xlog* log, const char* prefix){
+
+  long totals[STATS_COUNTERS];
+  stats_snapshot(stats, totals);
+
+  xlog_printf(log, "%s: %ld customers served, %ld products bought, %ld queue changes, "
+            "%ld closures, %ld exit permissions, %ld customers sent away\n", prefix,
+            totals[STATS_SERVED_CUSTOMERS], totals[STATS_BOUGHT_PRODUCTS],
+            totals[STATS_CHANGED_QUEUES], totals[STATS_CLOSURES],
+            totals[STATS_PERMISSIONS], totals[STATS_EVICTIONS]);
+
+}
@@ -14,6 +14,10 @@
 #include <director.h>
 #include <cashier.h>
 #include <customer.h>
+#include <customer_engine.h>
+#include <customer_pool.h>
+#include <stats.h>
+#include <timer_wheel.h>
 #include <utils.h>
 
 
@@ -122,6 +126,28 @@ int main(int argc, char** argv){
       case 'X': CHECK_GREATER_EQUAL_ONE(value, config_param.director_too_many_customers, var_name);
       case 'Y': CHECK_GREATER_EQUAL_ONE(value, config_param.director_below_min_limit, var_name);
       case 'Z': CHECK_GREATER_EQUAL_ONE(value, config_param.director_above_max_limit, var_name);
+      case 'R': CHECK_GREATER_EQUAL_ZERO(value, config_param.queue_reserved_nodes, var_name);
+      case 'Q': CHECK_GREATER_EQUAL_ZERO(value, config_param.cashiers_queue_kind, var_name);
+      case 'D': CHECK_GREATER_EQUAL_ZERO(value, config_param.director_queue_kind, var_name);
+      case 'B': CHECK_GREATER_EQUAL_ONE(value, config_param.queue_capacity, var_name);
+      case 'G': CHECK_GREATER_EQUAL_ZERO(value, config_param.customer_engine_workers, var_name);
+      case 'H': CHECK_GREATER_EQUAL_ZERO(value, config_param.timer_wheel_enabled, var_name);
+      case 'S': CHECK_GREATER_EQUAL_ZERO(value, config_param.selection_policy, var_name);
+      case 'U': CHECK_GREATER_EQUAL_ZERO(value, config_param.shared_line_enabled, var_name);
+      case 'w': CHECK_GREATER_EQUAL_ZERO(value, config_param.steal_wait, var_name);
+      case 'x': CHECK_GREATER_EQUAL_ZERO(value, config_param.express_cashiers, var_name);
+      case 'y': CHECK_GREATER_EQUAL_ONE(value, config_param.express_products_limit, var_name);
+      case 'a': CHECK_GREATER_EQUAL_ZERO(value, config_param.priority_aging, var_name);
+      case 'J': CHECK_GREATER_EQUAL_ZERO(value, config_param.jockey_margin, var_name);
+      case 'A': CHECK_GREATER_EQUAL_ZERO(value, config_param.scheduler, var_name);
+      case 't': CHECK_GREATER_EQUAL_ONE(value, config_param.target_wait, var_name);
+      case 'p': CHECK_GREATER_EQUAL_ONE(value, config_param.slo_percentile, var_name);
+      case 'k': CHECK_GREATER_EQUAL_ZERO(value, config_param.max_cashiers, var_name);
+      case 'c': CHECK_GREATER_EQUAL_ZERO(value, config_param.customer_pool_threads, var_name);
+      case 'l': CHECK_GREATER_EQUAL_ZERO(value, config_param.log_writer_enabled, var_name);
+      case 'o': CHECK_GREATER_EQUAL_ZERO(value, config_param.log_overflow, var_name);
+      case 'b': CHECK_GREATER_EQUAL_ZERO(value, config_param.binary_log_enabled, var_name);
+      case 'h': CHECK_GREATER_EQUAL_ZERO(value, config_param.latency_snapshot, var_name);
       case 'I': GET_LOG_FILE(value, len, config_param.file_log_supermarket);
       case 'L': GET_LOG_FILE(value, len, config_param.file_log_cashiers);
       case 'M': GET_LOG_FILE(value, len, config_param.file_log_customers);
@@ -137,6 +163,75 @@ int main(int argc, char** argv){
   if (fclose(config_file)) perror("fclose");
   free(buffer);
 
+  if (config_param.cashiers_queue_kind > QUEUE_RING){
+    printf("parameter \"Q\" must be between %d and %d\n", QUEUE_LIST, QUEUE_RING);
+    config_param.cashiers_queue_kind = QUEUE_LIST;
+  }
+
+  //The director list is popped by the director only, but a QUEUE_MPSC
+  //  would also need the cashiers handler to be the same thread
+  if (config_param.director_queue_kind != QUEUE_LIST && config_param.director_queue_kind != QUEUE_RING){
+    printf("parameter \"D\" must be %d or %d\n", QUEUE_LIST, QUEUE_RING);
+    config_param.director_queue_kind = QUEUE_LIST;
+  }
+
+  if (config_param.selection_policy > SELECT_SHORTEST_WORK){
+    printf("parameter \"S\" must be between %d and %d\n", SELECT_RANDOM, SELECT_SHORTEST_WORK);
+    config_param.selection_policy = SELECT_RANDOM;
+  }
+
+  //At least one cashier must be left for the customers with many products
+  if (config_param.express_cashiers >= config_param.cashiers_count){
+    printf("parameter \"x\" must be less than \"K\"\n");
+    config_param.express_cashiers = 0;
+  }
+
+  //On the shared line there is no queue to choose
+  if (config_param.express_cashiers > 0 && config_param.shared_line_enabled){
+    printf("parameter \"x\" is ignored when \"U\" is 1\n");
+    config_param.express_cashiers = 0;
+  }
+
+  //Only a linked list can be kept sorted
+  if (config_param.priority_aging > 0 && !config_param.shared_line_enabled
+          && config_param.cashiers_queue_kind != QUEUE_LIST){
+    printf("parameter \"a\" can only be used when \"Q\" is %d\n", QUEUE_LIST);
+    config_param.priority_aging = 0;
+  }
+
+  if (config_param.scheduler > SCHEDULER_SLO){
+    printf("parameter \"A\" must be between %d and %d\n", SCHEDULER_THRESHOLDS, SCHEDULER_SLO);
+    config_param.scheduler = SCHEDULER_THRESHOLDS;
+  }
+
+  if (config_param.slo_percentile > 99){
+    printf("parameter \"p\" must be between 1 and 99\n");
+    config_param.slo_percentile = 95;
+  }
+
+  if (config_param.max_cashiers > 0 && config_param.max_cashiers < config_param.cashiers_count){
+    printf("parameter \"k\" must be 0 or at least \"K\"\n");
+    config_param.max_cashiers = config_param.cashiers_count;
+  }
+
+  if (config_param.log_overflow > XLOG_OVERFLOW_DROP){
+    printf("parameter \"o\" must be %d or %d\n", XLOG_OVERFLOW_BLOCK, XLOG_OVERFLOW_DROP);
+    config_param.log_overflow = XLOG_OVERFLOW_BLOCK;
+  }
+
+  if (config_param.customer_pool_threads > 0 && config_param.customer_engine_workers > 0){
+    printf("parameter \"c\" is ignored when \"G\" is greater than 0\n");
+    config_param.customer_pool_threads = 0;
+  }
+
+  //Customers can only be taken from the tail of a linked list,
+  //  and on the shared line there is no other queue to go to
+  if (config_param.jockey_margin > 0 && (config_param.shared_line_enabled
+          || config_param.cashiers_queue_kind != QUEUE_LIST)){
+    printf("parameter \"J\" can only be used when \"Q\" is %d and \"U\" is 0\n", QUEUE_LIST);
+    config_param.jockey_margin = 0;
+  }
+
   //Auxiliar conifguration variables
   //These variables are not taken from config file
   int customers_count = 0;
@@ -144,25 +239,57 @@ int main(int argc, char** argv){
   // -----------------------------
 
 
+  // -- TIMER WHEEL INITIALIZATION --
+  //The engine always waits on the wheel, every
+  //  other thread only if H is set
+  timer_wheel_t* wheel = NULL;
+  if (config_param.timer_wheel_enabled || config_param.customer_engine_workers > 0){
+    wheel = timer_wheel_init();
+  }
+  if (config_param.timer_wheel_enabled) nanotimer_set_wheel(wheel);
+  // --------------------------------
+
+
   // -- XLOGS INITIALIZATION SECTION --
   struct __xlog supermarket_log;
   pthread_mutex_t supermarket_log_mutex = PTHREAD_MUTEX_INITIALIZER;
   supermarket_log.file = config_param.file_log_supermarket;
   supermarket_log.mutex = &supermarket_log_mutex;
-  //The following two vars will be updated under
-  //  the same lock as the supermarket log
-  int served_customers_count = 0;
-  int bought_products_count = 0;
-
+  supermarket_log.id = -1;
+  supermarket_log.binary = config_param.binary_log_enabled;
+  //Each run starts with a header, since the log is opened in append mode
+  if (supermarket_log.binary){
+    struct __binlog_header header;
+    binlog_header_init(&header);
+    xlog_write(&supermarket_log, &header, sizeof(struct __binlog_header));
+  }
   struct __xlog cashiers_log;
   pthread_mutex_t cashiers_log_mutex = PTHREAD_MUTEX_INITIALIZER;
   cashiers_log.file = config_param.file_log_cashiers;
   cashiers_log.mutex = &cashiers_log_mutex;
+  cashiers_log.id = -1;
+  cashiers_log.binary = 0;
 
   struct __xlog customers_log;
   pthread_mutex_t customers_log_mutex = PTHREAD_MUTEX_INITIALIZER;
   customers_log.file = config_param.file_log_customers;
   customers_log.mutex = &customers_log_mutex;
+  customers_log.id = -1;
+  customers_log.binary = 0;
+
+  struct __xlog director_log;
+  pthread_mutex_t director_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+  director_log.file = config_param.file_log_director;
+  director_log.mutex = &director_log_mutex;
+  director_log.id = -1;
+  director_log.binary = 0;
+
+  //With l=1 the lines are written by a single thread in large batches,
+  //  and the threads logging never wait for each other
+  struct __xlog* xlogs[] = {&supermarket_log, &cashiers_log, &customers_log, &director_log};
+  if (config_param.log_writer_enabled){
+    xlog_writer_start(xlogs, sizeof(xlogs)/sizeof(struct __xlog*), config_param.log_overflow);
+  }
   // ---------------------------------
 
 
@@ -177,28 +304,69 @@ int main(int argc, char** argv){
 
 
   // --- CASHIERS INITIALIZATION ----
+  //The table is allocated once with room for every cashier the director
+  //  may add, so that it's never moved while customers are reading it
   struct __all_cashiers all_cashiers;
-  all_cashiers.cashiers_list = xmalloc(sizeof(cashier_t*)*config_param.cashiers_count);
+  all_cashiers.max_count = config_param.max_cashiers > 0 ? config_param.max_cashiers
+                                : config_param.cashiers_count;
+  all_cashiers.cashiers_list = xmalloc(sizeof(cashier_t*)*all_cashiers.max_count);
+  memset(all_cashiers.cashiers_list, 0, sizeof(cashier_t*)*all_cashiers.max_count);
   all_cashiers.count = config_param.cashiers_count;
+  all_cashiers.selection_policy = config_param.selection_policy;
+  all_cashiers.steal_wait = 0;
+  all_cashiers.express_first = config_param.cashiers_count - config_param.express_cashiers;
+  all_cashiers.express_end = config_param.cashiers_count;
+  all_cashiers.express_products_limit = config_param.express_products_limit;
+  all_cashiers.priority_aging = config_param.priority_aging;
+  for (int i = 0; i<CASHIER_CLASSES; i++){
+    open_cashiers_init(&all_cashiers.open_cashiers[i], all_cashiers.max_count);
+    all_cashiers.arrivals[i] = 0;
+    histogram_init(&all_cashiers.queue_wait[i]);
+  }
+  stats_init(&all_cashiers.stats, all_cashiers.max_count);
+  all_cashiers.service_time = xmalloc(sizeof(latency_histogram_t)*all_cashiers.max_count);
+  for (int i = 0; i<all_cashiers.max_count; i++){
+    latency_histogram_init(&all_cashiers.service_time[i]);
+  }
+  latency_histogram_init(&all_cashiers.queue_time);
+  latency_histogram_init(&all_cashiers.supermarket_time);
+  latency_histogram_init(&all_cashiers.permission_wait);
+
+  //The shared line can't be a QUEUE_MPSC, since it has many
+  //  consumers, and must be able to stop a closed cashier
+  struct __shared_line shared_line;
+  all_cashiers.shared_line = NULL;
+  if (config_param.shared_line_enabled){
+    queue_init(&shared_line.queue, QUEUE_LIST, config_param.queue_reserved_nodes,
+                config_param.queue_capacity);
+    shared_line.pending_products = 0;
+    all_cashiers.shared_line = &shared_line;
+  }
 
   for (int i = 0; i<config_param.cashiers_count; i++){
     all_cashiers.cashiers_list[i] = cashier_init(i, config_param.initial_open_cashiers,
                 config_param.cashiers_variable_service_time, &cashiers_log,
-                config_param.report_to_director_frequency, &customers_counter, &supermarket_seed,
-                &supermarket_log, &served_customers_count, &bought_products_count);
+                &customers_counter, &supermarket_seed,
+                &supermarket_log, config_param.cashiers_queue_kind, config_param.queue_reserved_nodes,
+                config_param.queue_capacity, &all_cashiers);
     CHECK_PTR(all_cashiers.cashiers_list[i], "Received NULL pointer from cashier_init", exit(3));
+    cashier_t* current_cashier = all_cashiers.cashiers_list[i];
+    if (*current_cashier->status == OPEN){
+      open_cashiers_add(&all_cashiers.open_cashiers[current_cashier->cashier_class], i);
+    }
+  }
+
+  //Cashiers can steal from each other only once they all exist
+  if (!all_cashiers.shared_line && config_param.cashiers_queue_kind == QUEUE_LIST){
+    __atomic_store_n(&all_cashiers.steal_wait, config_param.steal_wait, __ATOMIC_RELEASE);
   }
   // --------------------------------
 
 
   // --- DIRECTOR INITIALIZATION ----
   queue_t director_permissions_list;
-  director_permissions_list.fifo = xmalloc(sizeof(fifo_unbounded_t));
-  fifo_init(director_permissions_list.fifo);
-  director_permissions_list.mutex = xmalloc(sizeof(pthread_mutex_t));
-  CHECK_ERR(pthread_mutex_init(director_permissions_list.mutex, NULL), "mutex init");
-  director_permissions_list.empty = xmalloc(sizeof(pthread_cond_t));
-  CHECK_ERR(pthread_cond_init(director_permissions_list.empty, NULL), "cond init");
+  queue_init(&director_permissions_list, config_param.director_queue_kind,
+                config_param.queue_reserved_nodes, config_param.queue_capacity);
 
   pthread_t entrance_thread;
 
@@ -207,18 +375,37 @@ int main(int argc, char** argv){
   cashiers_handler_args.director_too_many_customers = config_param.director_too_many_customers;
   cashiers_handler_args.director_below_min_limit = config_param.director_below_min_limit;
   cashiers_handler_args.director_above_max_limit = config_param.director_above_max_limit;
-  cashiers_handler_args.initial_open_cashiers = config_param.initial_open_cashiers;
+  cashiers_handler_args.jockey_margin = config_param.jockey_margin;
+  cashiers_handler_args.scheduler = config_param.scheduler;
+  cashiers_handler_args.target_wait = config_param.target_wait;
+  cashiers_handler_args.slo_percentile = config_param.slo_percentile;
+  cashiers_handler_args.elastic_cashiers = config_param.max_cashiers > 0;
+  cashiers_handler_args.latency_snapshot = config_param.latency_snapshot;
+  cashiers_handler_args.report_to_director_frequency = config_param.report_to_director_frequency;
   director_t* director = director_init(&all_cashiers, &director_permissions_list, &customers_counter,
-          &entrance_thread, config_param.file_log_director, &cashiers_handler_args);
+          &entrance_thread, &director_log, &cashiers_handler_args);
   CHECK_PTR(director, "Received NULL pointer from director_init", exit(3));
   // --------------------------------
 
 
   // --- CUSTOMERS INITIALIZATION ---
+  //With G=0 and c=0 every customer has its own thread
+  customer_engine_t* engine = NULL;
+  if (config_param.customer_engine_workers > 0){
+    engine = customer_engine_init(config_param.customer_engine_workers,
+                config_param.queue_reserved_nodes, wheel);
+  }
+
+  customer_pool_t* pool = NULL;
+  if (config_param.customer_pool_threads > 0){
+    pool = customer_pool_init(config_param.customer_pool_threads, config_param.queue_reserved_nodes);
+  }
+
   for (int i = 0; i<config_param.customers_limit; i++){
     customer_t* res = customer_init(i, &all_cashiers, &customers_counter,
               &director_permissions_list, &customers_log, config_param.max_fixed_time_to_shop,
-              config_param.max_fixed_products_count, &supermarket_seed, &supermarket_log);
+              config_param.max_fixed_products_count, &supermarket_seed, &supermarket_log,
+              engine, pool);
     CHECK_PTR(res, "Received NULL pointer from customer_init", NULL);
     free(res);
   }
@@ -237,6 +424,11 @@ int main(int argc, char** argv){
   entrance_args.director_permissions_list = &director_permissions_list;
   entrance_args.log = &customers_log;
   entrance_args.supermarket_log = &supermarket_log;
+  entrance_args.engine = engine;
+  entrance_args.pool = pool;
+  entrance_args.let_in_count = 0;
+  entrance_args.let_in_usecs = 0;
+  entrance_args.max_let_in_usecs = 0;
 
   CHECK_PTHREAD_CREATE( pthread_create(&entrance_thread, NULL, entrance, &entrance_args),
               "entrance", exit(EXIT_FAILURE) );
@@ -252,14 +444,54 @@ int main(int argc, char** argv){
   //Upon closure, the director thread will be joined
   director_join(director);
 
-  for (int i = 0; i<config_param.cashiers_count; i++){
+  //The director may have added cashiers beyond K
+  for (int i = 0; i<all_cashiers.count; i++){
+    cashier_wake_up(all_cashiers.cashiers_list[i]);
+  }
+
+  for (int i = 0; i<all_cashiers.count; i++){
     cashier_join(all_cashiers.cashiers_list[i]);
   }
 
+  if (all_cashiers.shared_line) queue_free(&all_cashiers.shared_line->queue);
+
   free(all_cashiers.cashiers_list);
+  for (int i = 0; i<CASHIER_CLASSES; i++){
+    open_cashiers_free(&all_cashiers.open_cashiers[i]);
+  }
 
-  fprintf(config_param.file_log_supermarket, "Served Customers: %d\n", served_customers_count);
-  fprintf(config_param.file_log_supermarket, "Bought products: %d\n", bought_products_count);
+  //Every customer is out once the director has been joined
+  if (engine) customer_engine_join(engine);
+  if (pool) customer_pool_join(pool, &director_log);
+
+  //The entrance has been joined by the director
+  long let_in_usecs = entrance_args.let_in_usecs;
+  xlog_printf(&director_log, "Entrance: %ld customers let in, %ld us average "
+            "(max %ld us) each, %.0f customers/s\n", entrance_args.let_in_count,
+            entrance_args.let_in_count ? let_in_usecs/entrance_args.let_in_count : 0,
+            entrance_args.max_let_in_usecs,
+            let_in_usecs ? (double)entrance_args.let_in_count*MILLION/let_in_usecs : 0.0);
+
+  if (wheel){
+    nanotimer_set_wheel(NULL);
+    xlog_printf(&director_log, "Timer wheel: %ld timers fired, %ld cascaded\n",
+              wheel->fired, wheel->cascaded);
+    timer_wheel_free(wheel);
+  }
+
+  stats_print(&all_cashiers.stats, &director_log, "Final stats");
+  latency_report(&all_cashiers, &director_log, "Latencies");
+  free(all_cashiers.service_time);
+
+  //Every thread is done logging. From now on the lines
+  //  are written right away, so these two are the last ones.
+  if (config_param.log_writer_enabled) xlog_writer_stop(&director_log);
+
+  struct __binlog_record totals_record;
+  binlog_totals(&totals_record, stats_read(&all_cashiers.stats, STATS_SERVED_CUSTOMERS),
+            stats_read(&all_cashiers.stats, STATS_BOUGHT_PRODUCTS));
+  xlog_record(&supermarket_log, &totals_record);
+  stats_free(&all_cashiers.stats);
 
 
   CHECK_ERR(fclose(config_param.file_log_supermarket), "fclose");
@@ -307,13 +539,27 @@ void* entrance(void* args_pointer){
     //This is permissible as specific.
     for (int i = 0; i<new_customers_count; i++){
 
+      struct timespec let_in_start;
+      SYS_CALL(clock_gettime(CLOCK_MONOTONIC, &let_in_start), "clock_gettime");
+
       customer_t* res = customer_init(progressive_id, args->all_cashiers, args->customers_counter,
               args->director_permissions_list, args->log, args->max_fixed_time_to_shop,
-              args->max_fixed_products_count, args->supermarket_seed, args->supermarket_log);
+              args->max_fixed_products_count, args->supermarket_seed, args->supermarket_log,
+              args->engine, args->pool);
       CHECK_PTR(res, "Received NULL pointer from customer_init", NULL);
       free(res);
       progressive_id++;
 
+      //Time the entrance is busy letting in a single customer
+      struct timespec let_in_end;
+      SYS_CALL(clock_gettime(CLOCK_MONOTONIC, &let_in_end), "clock_gettime");
+      struct timespec let_in;
+      timespec_diff(&let_in_start, &let_in_end, &let_in);
+      long let_in_usecs = let_in.tv_sec*MILLION + let_in.tv_nsec/THOUSAND;
+      args->let_in_count++;
+      args->let_in_usecs += let_in_usecs;
+      if (let_in_usecs > args->max_let_in_usecs) args->max_let_in_usecs = let_in_usecs;
+
     }
 
   }
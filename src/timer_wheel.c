@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include <timer_wheel.h>
+#include <utils.h>
+
+
+static void* timer_wheel_thread(void* args_pointer);
+
+
+//Arms the timerfd to tick every millisecond, or disarms it
+static void set_ticking(timer_wheel_t* wheel, int ticking){
+
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(struct itimerspec));
+  if (ticking){
+    spec.it_value.tv_nsec = MILLION;
+    spec.it_interval.tv_nsec = MILLION;
+  }
+
+  SYS_CALL(timerfd_settime(wheel->fd, 0, &spec, NULL), "timerfd_settime");
+
+}
+
+
+timer_wheel_t* timer_wheel_init(){
+
+  timer_wheel_t* wheel = xmalloc(sizeof(timer_wheel_t));
+  memset(wheel->slots, 0, sizeof(wheel->slots));
+  wheel->now = 0;
+  wheel->pending = 0;
+  wheel->stop = 0;
+  wheel->fired = 0;
+  wheel->cascaded = 0;
+
+  SYS_CALL_RETURN(wheel->fd, timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC), "timerfd_create");
+  CHECK_ERR(pthread_mutex_init(&wheel->mutex, NULL), "mutex init");
+
+  CHECK_PTHREAD_CREATE( pthread_create(&wheel->thread, NULL, timer_wheel_thread, wheel),
+              "timer wheel", exit(EXIT_FAILURE) );
+
+  return wheel;
+
+}
+
+
+void timer_wheel_free(timer_wheel_t* wheel){
+
+  XLOCK(&wheel->mutex);
+  wheel->stop = 1;
+  //One last tick to wake up the thread
+  set_ticking(wheel, 1);
+  XUNLOCK(&wheel->mutex);
+
+  CHECK_PTHREAD_JOIN(pthread_join(wheel->thread, NULL),
+                "timer wheel", exit(EXIT_FAILURE));
+
+  CHECK_ERR(close(wheel->fd), "close");
+  CHECK_ERR(pthread_mutex_destroy(&wheel->mutex), "mutex destroy");
+  free(wheel);
+
+}
+
+
+//Must be called with the wheel mutex locked.
+//The level is chosen by how far the timer is from now, so that a
+//  timer is always moved to a lower level before it expires.
+static void place_timer(timer_wheel_t* wheel, struct __timer* timer){
+
+  unsigned long delta = timer->expires - wheel->now;
+
+  int level = 0;
+  while (level < WHEEL_LEVELS-1 && delta >= (1UL << (WHEEL_BITS*(level+1)))){
+    level++;
+  }
+
+  int slot = (timer->expires >> (WHEEL_BITS*level)) & WHEEL_MASK;
+  timer->next = wheel->slots[level][slot];
+  wheel->slots[level][slot] = timer;
+
+}
+
+
+void timer_wheel_add(timer_wheel_t* wheel, struct __timer* timer, int msecs,
+            void (*callback)(void* arg), void* arg){
+
+  //The last level can't hold timers further than its whole length
+  unsigned long max_delta = (1UL << (WHEEL_BITS*WHEEL_LEVELS)) - 1;
+  unsigned long delta = msecs < 1 ? 1 : msecs;
+  if (delta > max_delta) delta = max_delta;
+
+  timer->callback = callback;
+  timer->arg = arg;
+
+  XLOCK(&wheel->mutex);
+
+  timer->expires = wheel->now + delta;
+  place_timer(wheel, timer);
+
+  if (wheel->pending++ == 0) set_ticking(wheel, 1);
+
+  XUNLOCK(&wheel->mutex);
+
+}
+
+
+//Must be called with the wheel mutex locked.
+//Moves the timers of the current slot of a level to the lower levels.
+static void cascade(timer_wheel_t* wheel, int level){
+
+  int slot = (wheel->now >> (WHEEL_BITS*level)) & WHEEL_MASK;
+  struct __timer* timer = wheel->slots[level][slot];
+  wheel->slots[level][slot] = NULL;
+
+  while (timer){
+    struct __timer* next = timer->next;
+    place_timer(wheel, timer);
+    wheel->cascaded++;
+    timer = next;
+  }
+
+}
+
+
+static void* timer_wheel_thread(void* args_pointer){
+
+  timer_wheel_t* wheel = (timer_wheel_t*)args_pointer;
+
+  while (1){
+
+    //The number of ticks elapsed since the last read, more
+    //  than one if this thread has fallen behind
+    uint64_t ticks = 0;
+    if (read(wheel->fd, &ticks, sizeof(uint64_t)) == -1){
+      if (errno == EINTR) continue;
+      perror("read");
+      ERROR_AT;
+      exit(EXIT_FAILURE);
+    }
+
+    XLOCK(&wheel->mutex);
+
+    for (uint64_t i = 0; i<ticks && wheel->pending > 0 && !wheel->stop; i++){
+
+      wheel->now++;
+
+      //Higher levels are cascaded first, since their
+      //  timers may end up in the current slot
+      for (int level = WHEEL_LEVELS-1; level>0; level--){
+        if ((wheel->now & ((1UL << (WHEEL_BITS*level)) - 1)) == 0) cascade(wheel, level);
+      }
+
+      int slot = wheel->now & WHEEL_MASK;
+      struct __timer* expired = wheel->slots[0][slot];
+      wheel->slots[0][slot] = NULL;
+
+      //Callbacks are called without the lock, so that
+      //  they can schedule new timers
+      while (expired){
+        struct __timer* next = expired->next;
+        wheel->pending--;
+        wheel->fired++;
+        XUNLOCK(&wheel->mutex);
+        expired->callback(expired->arg);
+        XLOCK(&wheel->mutex);
+        expired = next;
+      }
+
+    }
+
+    //Checked only now, with the lock held: timer_wheel_free() may have
+    //  armed its last tick while a callback was running, and disarming
+    //  the timerfd here would leave this thread in read() forever
+    if (wheel->stop){
+      XUNLOCK(&wheel->mutex);
+      break;
+    }
+
+    if (wheel->pending == 0) set_ticking(wheel, 0);
+
+    XUNLOCK(&wheel->mutex);
+
+  }
+
+  return NULL;
+
+}
+
+
+struct __timer_wheel_sleeper{
+  int done;
+  pthread_mutex_t mutex;
+  pthread_cond_t wake_up;
+};
+
+
+static void wake_sleeper(void* arg){
+
+  struct __timer_wheel_sleeper* sleeper = arg;
+
+  XLOCK(&sleeper->mutex);
+  sleeper->done = 1;
+  XSIGNAL(&sleeper->wake_up);
+  XUNLOCK(&sleeper->mutex);
+
+}
+
+
+void timer_wheel_sleep(timer_wheel_t* wheel, int msecs){
+
+  struct __timer timer;
+  struct __timer_wheel_sleeper sleeper;
+  sleeper.done = 0;
+  CHECK_ERR(pthread_mutex_init(&sleeper.mutex, NULL), "mutex init");
+  CHECK_ERR(pthread_cond_init(&sleeper.wake_up, NULL), "cond init");
+
+  timer_wheel_add(wheel, &timer, msecs, wake_sleeper, &sleeper);
+
+  XLOCK(&sleeper.mutex);
+  while (!sleeper.done){
+    XWAIT(&sleeper.wake_up, &sleeper.mutex);
+  }
+  XUNLOCK(&sleeper.mutex);
+
+  CHECK_ERR(pthread_mutex_destroy(&sleeper.mutex), "mutex destroy");
+  CHECK_ERR(pthread_cond_destroy(&sleeper.wake_up), "cond destroy");
+
+}
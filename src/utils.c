@@ -1,7 +1,9 @@
 #include <utils.h>
+#include <timer_wheel.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 
 void* xmalloc(size_t bytes){
 
@@ -16,6 +18,228 @@ void* xmalloc(size_t bytes){
 
 }
 
+void queue_init(queue_t* queue, int kind, int reserved_nodes, int capacity){
+
+  queue->kind = kind;
+  queue->fifo = NULL;
+  queue->mutex = NULL;
+  queue->empty = NULL;
+  queue->mpsc = NULL;
+  queue->ring = NULL;
+
+  switch (kind) {
+
+    case QUEUE_RING:
+      queue->ring = xmalloc(sizeof(fifo_ring_t));
+      fifo_ring_init(queue->ring, capacity);
+      break;
+
+    case QUEUE_MPSC:
+      queue->mpsc = xmalloc(sizeof(fifo_mpsc_t));
+      fifo_mpsc_init(queue->mpsc);
+      fifo_mpsc_reserve(queue->mpsc, reserved_nodes);
+      break;
+
+    default:
+      queue->kind = QUEUE_LIST;
+      queue->fifo = xmalloc(sizeof(fifo_unbounded_t));
+      fifo_init(queue->fifo);
+      fifo_reserve(queue->fifo, reserved_nodes, NULL);
+      queue->mutex = xmalloc(sizeof(pthread_mutex_t));
+      CHECK_ERR(pthread_mutex_init(queue->mutex, NULL), "mutex init");
+      queue->empty = xmalloc(sizeof(pthread_cond_t));
+      CHECK_ERR(pthread_cond_init(queue->empty, NULL), "cond init");
+      break;
+
+  }
+
+}
+
+void queue_free(queue_t* queue){
+
+  switch (queue->kind) {
+
+    case QUEUE_RING:
+      free_ring(queue->ring);
+      free(queue->ring);
+      break;
+
+    case QUEUE_MPSC:
+      free_mpsc(queue->mpsc);
+      free(queue->mpsc);
+      break;
+
+    default:
+      free_fifo(queue->fifo);
+      free(queue->fifo);
+      free(queue->mutex);
+      free(queue->empty);
+      break;
+
+  }
+
+}
+
+void queue_push(queue_t* queue, void* elem){
+
+  switch (queue->kind) {
+    case QUEUE_RING: push_ring(queue->ring, elem); break;
+    case QUEUE_MPSC: push_mpsc(queue->mpsc, elem); break;
+    default: push_fifo(queue->fifo, elem, queue->mutex, queue->empty); break;
+  }
+
+}
+
+int queue_try_push(queue_t* queue, void* elem){
+
+  if (queue->kind == QUEUE_RING) return try_push_ring(queue->ring, elem);
+
+  //Unbounded queues are never full
+  queue_push(queue, elem);
+  return 1;
+
+}
+
+void queue_push_node(queue_t* queue, struct __node* node){
+
+  switch (queue->kind) {
+    //The ring has its own cells, the node is not needed
+    case QUEUE_RING: push_ring(queue->ring, node->elem); break;
+    case QUEUE_MPSC: push_node_mpsc(queue->mpsc, node); break;
+    default: push_node_fifo(queue->fifo, node, queue->mutex, queue->empty); break;
+  }
+
+}
+
+int queue_try_push_node(queue_t* queue, struct __node* node){
+
+  if (queue->kind == QUEUE_RING) return try_push_ring(queue->ring, node->elem);
+
+  queue_push_node(queue, node);
+  return 1;
+
+}
+
+int queue_try_push_node_sorted(queue_t* queue, struct __node* node, long key){
+
+  if (queue->kind != QUEUE_LIST) return queue_try_push_node(queue, node);
+
+  push_node_sorted_fifo(queue->fifo, node, key, queue->mutex, queue->empty);
+  return 1;
+
+}
+
+void* queue_pop(queue_t* queue){
+
+  switch (queue->kind) {
+    case QUEUE_RING: return pop_ring(queue->ring);
+    case QUEUE_MPSC: return pop_mpsc(queue->mpsc);
+    default: return pop_fifo(queue->fifo, queue->mutex, queue->empty);
+  }
+
+}
+
+void* queue_pop_while(queue_t* queue, int* flag){
+
+  if (queue->kind != QUEUE_LIST) return queue_pop(queue);
+
+  return pop_fifo_while(queue->fifo, flag, queue->mutex, queue->empty);
+
+}
+
+int queue_pop_timed(queue_t* queue, void** elem, int msecs){
+
+  if (queue->kind != QUEUE_LIST){
+    *elem = queue_pop(queue);
+    return 1;
+  }
+
+  return pop_fifo_timed(queue->fifo, elem, msecs, queue->mutex, queue->empty);
+
+}
+
+int queue_steal(queue_t* queue, void** elem){
+
+  if (queue->kind != QUEUE_LIST) return 0;
+
+  return steal_tail_fifo(queue->fifo, elem, queue->mutex);
+
+}
+
+int queue_steal_head(queue_t* queue, void** elem){
+
+  if (queue->kind != QUEUE_LIST) return 0;
+
+  return steal_head_fifo(queue->fifo, elem, queue->mutex);
+
+}
+
+void queue_wake_all(queue_t* queue){
+
+  if (queue->kind != QUEUE_LIST){
+    queue_wake_up(queue);
+    return;
+  }
+
+  wake_all_fifo(queue->mutex, queue->empty);
+
+}
+
+int queue_try_pop(queue_t* queue, void** elem){
+
+  switch (queue->kind) {
+    case QUEUE_RING: return try_pop_ring(queue->ring, elem);
+    case QUEUE_MPSC: return try_pop_mpsc(queue->mpsc, elem);
+    default: break;
+  }
+
+  int res = 0;
+  XLOCK(queue->mutex);
+  if (get_count_fifo(queue->fifo, NULL) > 0){
+    *elem = pop_fifo(queue->fifo, NULL, NULL);
+    res = 1;
+  }
+  XUNLOCK(queue->mutex);
+
+  return res;
+
+}
+
+void queue_wake_up(queue_t* queue){
+
+  queue_try_push(queue, NULL);
+
+}
+
+int queue_count(queue_t* queue){
+
+  switch (queue->kind) {
+    case QUEUE_RING: return get_count_ring(queue->ring);
+    case QUEUE_MPSC: return get_count_mpsc(queue->mpsc);
+    default: return get_depth_fifo(queue->fifo);
+  }
+
+}
+
+void queue_stats(queue_t* queue, struct __fifo_stats* stats){
+
+  switch (queue->kind) {
+
+    //A ring never allocates after its initialization
+    case QUEUE_RING:
+      stats->allocated_nodes = get_capacity_ring(queue->ring);
+      stats->reused_nodes = 0;
+      stats->free_nodes = 0;
+      stats->full_pushes = __atomic_load_n(&queue->ring->full_pushes, __ATOMIC_RELAXED);
+      break;
+
+    case QUEUE_MPSC: get_stats_mpsc(queue->mpsc, stats); break;
+    default: get_stats_fifo(queue->fifo, stats, queue->mutex); break;
+
+  }
+
+}
+
 int my_strtoi(char* string){
 
   int res = 0;
@@ -33,8 +257,22 @@ int my_strtoi(char* string){
 
 }
 
+//Wheel shared by every nanotimer() call, if enabled
+static timer_wheel_t* nanotimer_wheel = NULL;
+
+void nanotimer_set_wheel(timer_wheel_t* wheel){
+
+  nanotimer_wheel = wheel;
+
+}
+
 void nanotimer(int microsecs){
 
+  if (nanotimer_wheel){
+    timer_wheel_sleep(nanotimer_wheel, microsecs);
+    return;
+  }
+
   //Scaling microsecond requested as specific to nanoseconds
   struct timespec sleep_time;
   sleep_time.tv_sec = microsecs/THOUSAND;
@@ -63,3 +301,30 @@ void timespec_diff(struct timespec* start, struct timespec* stop, struct timespe
   }
 
 }
+
+long timespec_nsecs(struct timespec* time){
+
+  return time->tv_sec*BILLION + time->tv_nsec;
+
+}
+
+
+long monotonic_msecs(){
+
+  struct timespec now;
+  SYS_CALL(clock_gettime(CLOCK_MONOTONIC, &now), "clock_gettime");
+
+  return now.tv_sec*THOUSAND + now.tv_nsec/MILLION;
+
+}
+
+void timespec_add_msecs(struct timespec* time, long msecs){
+
+  time->tv_sec += msecs/THOUSAND;
+  time->tv_nsec += (msecs%THOUSAND)*MILLION;
+  if (time->tv_nsec >= BILLION){
+    time->tv_sec++;
+    time->tv_nsec -= BILLION;
+  }
+
+}
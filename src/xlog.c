@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <utils.h>
+#include <xlog.h>
+
+
+//Ring of a single thread. Only the thread moves the tail and only
+//  the writer moves the head, so no lock is needed. Head and tail
+//  always grow, their remainder is the position in the buffer.
+struct __xlog_ring{
+  char buffer[XLOG_RING_BYTES];
+  unsigned long head;
+  unsigned long tail;
+  //Set when the thread exits: once empty, the ring can be freed
+  int dead;
+  //Value of dead read by the writer before its last pass
+  int dead_seen;
+  struct __xlog_ring* next;
+};
+
+//Written in the ring before each line
+struct __xlog_entry{
+  //CLOCK_MONOTONIC time of the line, used to write the lines of
+  //  the different threads in the order they were logged
+  long nsecs;
+  int id;
+  int len;
+};
+
+//Next line of a ring still to be written in the current pass
+struct __xlog_cursor{
+  struct __xlog_ring* ring;
+  unsigned long head;
+  unsigned long tail;
+  struct __xlog_entry entry;
+};
+
+//There is only one writer for the whole supermarket
+static struct __xlog_writer{
+  pthread_t thread;
+  //Protects the list of rings, changed when a thread logs for the
+  //  first time and by the writer when a dead ring is freed
+  pthread_mutex_t mutex;
+  struct __xlog_ring* rings;
+  struct __xlog_ring* last;
+  int live_rings;
+  //Set once the rings have been freed by xlog_writer_stop()
+  int stopped;
+  pthread_key_t key;
+  struct __xlog** logs;
+  int count;
+  char** batch;
+  int* batch_len;
+  //Min-heap on the time of the next line of each ring, used by the
+  //  writer only to merge the rings
+  struct __xlog_cursor* cursors;
+  int cursors_size;
+  int overflow;
+  int stop;
+  //Statistics written in the log at the end
+  long lines;
+  long bytes;
+  long writes;
+  long dropped;
+  long waits;
+  int rings_count;
+}writer = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+static _Thread_local struct __xlog_ring* thread_ring = NULL;
+
+
+static void* xlog_writer_thread(void* args_pointer);
+
+
+//Called when a thread with a ring exits. A detached thread may exit
+//  while xlog_writer_stop() is freeing the rings, so the ring is only
+//  touched under the mutex and if it still exists.
+static void ring_release(void* ring_pointer){
+
+  struct __xlog_ring* ring = ring_pointer;
+
+  XLOCK(&writer.mutex);
+  if (!writer.stopped) __atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+  XUNLOCK(&writer.mutex);
+
+}
+
+
+static struct __xlog_ring* get_ring(){
+
+  if (thread_ring) return thread_ring;
+
+  struct __xlog_ring* ring = xmalloc(sizeof(struct __xlog_ring));
+  ring->head = 0;
+  ring->tail = 0;
+  ring->dead = 0;
+  ring->dead_seen = 0;
+  ring->next = NULL;
+
+  XLOCK(&writer.mutex);
+  if (writer.last) writer.last->next = ring;
+  else writer.rings = ring;
+  writer.last = ring;
+  writer.live_rings++;
+  writer.rings_count++;
+  XUNLOCK(&writer.mutex);
+
+  CHECK_ERR(pthread_setspecific(writer.key, ring), "pthread_setspecific");
+  thread_ring = ring;
+
+  return ring;
+
+}
+
+
+static void ring_copy_in(struct __xlog_ring* ring, unsigned long position, const void* data, int len){
+
+  int offset = position & (XLOG_RING_BYTES-1);
+  int first = len < XLOG_RING_BYTES-offset ? len : XLOG_RING_BYTES-offset;
+  memcpy(ring->buffer+offset, data, first);
+  memcpy(ring->buffer, (const char*)data+first, len-first);
+
+}
+
+
+static void ring_copy_out(struct __xlog_ring* ring, unsigned long position, void* data, int len){
+
+  int offset = position & (XLOG_RING_BYTES-1);
+  int first = len < XLOG_RING_BYTES-offset ? len : XLOG_RING_BYTES-offset;
+  memcpy(data, ring->buffer+offset, first);
+  memcpy((char*)data+first, ring->buffer, len-first);
+
+}
+
+
+//Copies the line in the ring of the calling thread
+static void ring_push(int id, const void* line, int len){
+
+  struct __xlog_ring* ring = get_ring();
+  struct timespec now;
+  SYS_CALL(clock_gettime(CLOCK_MONOTONIC, &now), "clock_gettime");
+  struct __xlog_entry entry = {timespec_nsecs(&now), id, len};
+  int needed = sizeof(struct __xlog_entry) + len;
+
+  int waited = 0;
+  while (ring->tail + needed - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) > XLOG_RING_BYTES){
+    if (writer.overflow == XLOG_OVERFLOW_DROP){
+      __atomic_add_fetch(&writer.dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+    if (!waited++) __atomic_add_fetch(&writer.waits, 1, __ATOMIC_RELAXED);
+    sched_yield();
+  }
+
+  ring_copy_in(ring, ring->tail, &entry, sizeof(struct __xlog_entry));
+  ring_copy_in(ring, ring->tail + sizeof(struct __xlog_entry), line, len);
+  __atomic_store_n(&ring->tail, ring->tail + needed, __ATOMIC_RELEASE);
+
+}
+
+
+void xlog_printf(struct __xlog* log, const char* format, ...){
+
+  va_list list;
+  va_start(list, format);
+
+  int id = __atomic_load_n(&log->id, __ATOMIC_ACQUIRE);
+  if (id == -1){
+    XLOCK(log->mutex);
+    vfprintf(log->file, format, list);
+    XUNLOCK(log->mutex);
+    va_end(list);
+    return;
+  }
+
+  char line[XLOG_LINE_MAX];
+  int len = vsnprintf(line, XLOG_LINE_MAX, format, list);
+  va_end(list);
+  if (len < 0) return;
+  if (len >= XLOG_LINE_MAX) len = XLOG_LINE_MAX-1;
+
+  ring_push(id, line, len);
+
+}
+
+
+void xlog_write(struct __xlog* log, const void* data, int len){
+
+  int id = __atomic_load_n(&log->id, __ATOMIC_ACQUIRE);
+  if (id == -1){
+    XLOCK(log->mutex);
+    if (fwrite(data, 1, len, log->file) != len) perror("fwrite");
+    XUNLOCK(log->mutex);
+    return;
+  }
+
+  ring_push(id, data, len);
+
+}
+
+
+void xlog_record(struct __xlog* log, struct __binlog_record* record){
+
+  if (log->binary){
+    xlog_write(log, record, sizeof(struct __binlog_record));
+    return;
+  }
+
+  char line[XLOG_LINE_MAX];
+  int len = binlog_format(record, line, XLOG_LINE_MAX);
+  if (len >= XLOG_LINE_MAX) len = XLOG_LINE_MAX-1;
+  if (len > 0) xlog_write(log, line, len);
+
+}
+
+
+void xlog_writer_start(struct __xlog** logs, int count, int overflow){
+
+  writer.logs = logs;
+  writer.count = count;
+  writer.overflow = overflow;
+  writer.stop = 0;
+  writer.stopped = 0;
+  writer.rings = NULL;
+  writer.last = NULL;
+  writer.live_rings = 0;
+  writer.cursors = NULL;
+  writer.cursors_size = 0;
+  writer.lines = 0;
+  writer.bytes = 0;
+  writer.writes = 0;
+  writer.dropped = 0;
+  writer.waits = 0;
+  writer.rings_count = 0;
+
+  writer.batch = xmalloc(sizeof(char*)*count);
+  writer.batch_len = xmalloc(sizeof(int)*count);
+  for (int i = 0; i<count; i++){
+    writer.batch[i] = xmalloc(XLOG_BATCH_BYTES);
+    writer.batch_len[i] = 0;
+    //Anything written before goes first
+    CHECK_ERR(fflush(logs[i]->file), "fflush");
+  }
+
+  CHECK_ERR(pthread_key_create(&writer.key, ring_release), "pthread_key_create");
+
+  CHECK_PTHREAD_CREATE( pthread_create(&writer.thread, NULL, xlog_writer_thread, NULL),
+              "log writer", exit(EXIT_FAILURE) );
+
+  for (int i = 0; i<count; i++){
+    __atomic_store_n(&logs[i]->id, i, __ATOMIC_RELEASE);
+  }
+
+}
+
+
+void xlog_writer_stop(struct __xlog* stats_log){
+
+  __atomic_store_n(&writer.stop, 1, __ATOMIC_RELEASE);
+
+  CHECK_PTHREAD_JOIN(pthread_join(writer.thread, NULL),
+              "log writer", exit(EXIT_FAILURE));
+
+  for (int i = 0; i<writer.count; i++){
+    __atomic_store_n(&writer.logs[i]->id, -1, __ATOMIC_RELEASE);
+    free(writer.batch[i]);
+  }
+  free(writer.batch);
+  free(writer.batch_len);
+  free(writer.cursors);
+
+  //No destructor is called for the threads exiting from now on, and
+  //  the ones already running find stopped set once they get the mutex
+  CHECK_ERR(pthread_key_delete(writer.key), "pthread_key_delete");
+
+  //The rings of the threads still alive (like this one)
+  XLOCK(&writer.mutex);
+  writer.stopped = 1;
+  struct __xlog_ring* ring = writer.rings;
+  while (ring){
+    struct __xlog_ring* next = ring->next;
+    free(ring);
+    ring = next;
+  }
+  writer.rings = NULL;
+  writer.last = NULL;
+  XUNLOCK(&writer.mutex);
+  thread_ring = NULL;
+
+  if (stats_log){
+    xlog_printf(stats_log, "Log writer: %ld lines (%ld bytes) in %ld writes, %d thread rings, "
+              "%ld lines dropped, %ld waits for a full ring\n", writer.lines, writer.bytes,
+              writer.writes, writer.rings_count, writer.dropped, writer.waits);
+  }
+
+}
+
+
+static void flush_batch(int id){
+
+  int fd = fileno(writer.logs[id]->file);
+  char* data = writer.batch[id];
+  int len = writer.batch_len[id];
+
+  while (len > 0){
+    ssize_t written = write(fd, data, len);
+    if (written == -1){
+      if (errno == EINTR) continue;
+      perror("write");
+      break;
+    }
+    data += written;
+    len -= written;
+  }
+
+  if (writer.batch_len[id] > 0) writer.writes++;
+  writer.batch_len[id] = 0;
+
+}
+
+
+static int cursor_before(struct __xlog_cursor* a, struct __xlog_cursor* b){
+
+  return a->entry.nsecs < b->entry.nsecs;
+
+}
+
+
+static void cursors_sift_down(int count, int i){
+
+  struct __xlog_cursor* cursors = writer.cursors;
+
+  while (1){
+    int first = i;
+    int left = 2*i+1;
+    int right = left+1;
+    if (left < count && cursor_before(&cursors[left], &cursors[first])) first = left;
+    if (right < count && cursor_before(&cursors[right], &cursors[first])) first = right;
+    if (first == i) return;
+    struct __xlog_cursor temp = cursors[i];
+    cursors[i] = cursors[first];
+    cursors[first] = temp;
+    i = first;
+  }
+
+}
+
+
+//Moves the lines of every ring in the batches of their files, the
+//  oldest first, so that the files keep the order in which the lines
+//  were logged. Only the lines already in the rings when the pass starts
+//  are merged: a line logged meanwhile is written by the next pass.
+//Must be called with the list of rings locked. Returns the number of lines moved.
+static long drain_rings(){
+
+  if (writer.cursors_size < writer.live_rings){
+    writer.cursors_size = writer.live_rings;
+    writer.cursors = realloc(writer.cursors, sizeof(struct __xlog_cursor)*writer.cursors_size);
+    if (!writer.cursors){
+      perror("realloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  int count = 0;
+  for (struct __xlog_ring* ring = writer.rings; ring; ring = ring->next){
+    struct __xlog_cursor* cursor = &writer.cursors[count];
+    cursor->ring = ring;
+    cursor->head = ring->head;
+    cursor->tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (cursor->head == cursor->tail) continue;
+    ring_copy_out(ring, cursor->head, &cursor->entry, sizeof(struct __xlog_entry));
+    count++;
+  }
+
+  for (int i = count/2-1; i>=0; i--){
+    cursors_sift_down(count, i);
+  }
+
+  long lines = 0;
+
+  while (count > 0){
+
+    struct __xlog_cursor* cursor = &writer.cursors[0];
+    struct __xlog_ring* ring = cursor->ring;
+    int id = cursor->entry.id;
+    int len = cursor->entry.len;
+
+    if (writer.batch_len[id] + len > XLOG_BATCH_BYTES) flush_batch(id);
+    ring_copy_out(ring, cursor->head + sizeof(struct __xlog_entry),
+              writer.batch[id] + writer.batch_len[id], len);
+    writer.batch_len[id] += len;
+    cursor->head += sizeof(struct __xlog_entry) + len;
+
+    writer.bytes += len;
+    lines++;
+
+    if (cursor->head < cursor->tail){
+      ring_copy_out(ring, cursor->head, &cursor->entry, sizeof(struct __xlog_entry));
+    } else {
+      //The thread can use the space again as soon as its lines are out
+      __atomic_store_n(&ring->head, cursor->head, __ATOMIC_RELEASE);
+      writer.cursors[0] = writer.cursors[--count];
+    }
+    cursors_sift_down(count, 0);
+
+  }
+
+  return lines;
+
+}
+
+
+static void* xlog_writer_thread(void* args_pointer){
+
+  while (1){
+
+    //Once stop is seen, one last pass gets everything
+    int stop = __atomic_load_n(&writer.stop, __ATOMIC_ACQUIRE);
+    long lines = 0;
+
+    XLOCK(&writer.mutex);
+
+    //Read before draining: a dead thread can't write anymore
+    for (struct __xlog_ring* ring = writer.rings; ring; ring = ring->next){
+      ring->dead_seen = __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE);
+    }
+
+    lines = drain_rings();
+
+    struct __xlog_ring* previous = NULL;
+    struct __xlog_ring* ring = writer.rings;
+    while (ring){
+
+      struct __xlog_ring* next = ring->next;
+      if (ring->dead_seen){
+        if (previous) previous->next = next;
+        else writer.rings = next;
+        if (writer.last == ring) writer.last = previous;
+        writer.live_rings--;
+        free(ring);
+      } else {
+        previous = ring;
+      }
+      ring = next;
+
+    }
+
+    XUNLOCK(&writer.mutex);
+
+    for (int i = 0; i<writer.count; i++){
+      flush_batch(i);
+    }
+    writer.lines += lines;
+
+    if (stop) break;
+
+    if (lines == 0){
+      struct timespec idle = {0, XLOG_IDLE_MSECS*MILLION};
+      nanosleep(&idle, NULL);
+    }
+
+  }
+
+  return NULL;
+
+}